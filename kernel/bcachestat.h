@@ -0,0 +1,14 @@
+// Buffer cache statistics, filled in by the bcachestat() system call.
+// Needs param.h for NBUCKET.
+struct bcachestat {
+  uint64 nbuf;                 // buffers in the cache now
+  uint64 maxbuf;               // most it may grow to
+  uint64 nhot;                 // buffers holding blocks used again
+  uint64 nhit;                 // lookups that found the block cached
+  uint64 nmiss;                // lookups that had to recycle a buffer
+  uint64 nreadahead;           // blocks read ahead of use
+  uint64 nacquire[NBUCKET];    // acquisitions of each bucket's lock
+  uint64 ncontended[NBUCKET];  // of those, how many found it held
+  uint64 nevict;               // misses that threw out a cached block
+  uint64 nevictcontended;      // misses that waited for another
+};
@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -22,70 +22,427 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "bcachestat.h"
 
-struct {
+// The buffers are hashed on (dev, blockno) into NBUCKET buckets,
+// each with its own lock and its own list of buffers, so that
+// looking up and releasing blocks in different buckets don't
+// contend. No code holds more than one bucket lock at a time. A
+// buffer changes bucket only when it is recycled for another
+// block, which bget() does under bcache.lock.
+//
+// Which buffer to recycle is decided much as in the 2Q policy,
+// so that one pass over a big file (cat, wc) doesn't flush the
+// blocks that every operation uses (inodes, bitmap, directories).
+// A block comes into the cache cold, and turns hot when it is
+// used again after its buffer was released in an earlier tick;
+// uses close together, such as several small reads of one
+// block, don't count. A miss on a block that was recently
+// evicted while cold (it's in bcache.ghost[]) brings it back
+// hot. evict() recycles the least recently used cold buffer
+// as long as cold buffers make up more than a quarter of the
+// cache, and otherwise the least recently used hot one, so
+// blocks streaming through stay in that quarter.
+//
+// The cache starts with the NBUF buffers in bcache.buf[]. On a
+// miss it grows by a page of buffers (a chunk) at a time, up to
+// bcache.max buffers, as long as free memory lasts. When free
+// memory runs low, misses give back chunks whose buffers are
+// all unused, and kalloc() calls breclaim() for more when it
+// runs out.
+#define HASH(dev, blockno) (((dev) * 31 + (blockno)) % NBUCKET)
+
+// buffers that hold no block are dev 0's block 0, which
+// no disk uses, and live in its bucket.
+#define EMPTY HASH(0, 0)
+
+#define CHUNKBUFS ((PGSIZE - sizeof(void*)) / sizeof(struct buf))
+#define RECLAIM   8   // chunks breclaim() tries to free
+#define NGHOST    512 // recently evicted cold blocks to remember
+#define GHOST(dev, blockno) (((dev) * 31 + (blockno)) % NGHOST)
+
+struct bchunk {
+  struct bchunk *next;
+  struct buf buf[CHUNKBUFS];
+};
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
 
-  // Linked list of all buffers, through prev/next.
+  // Linked list of the bucket's buffers, through prev/next.
   // Sorted by how recently the buffer was used.
   // head.next is most recent, head.prev is least.
   struct buf head;
+
+  // statistics, protected by lock.
+  uint64 nacquire;
+  uint64 ncontended;
+  uint64 nhit;
+};
+
+struct {
+  struct spinlock lock;   // serializes evictions, growing and shrinking
+  struct buf buf[NBUF];
+  struct bucket bucket[NBUCKET];
+  struct bchunk *chunks;  // buffers added since boot
+  int nbuf;               // buffers in the cache
+  int max;                // most buffers the cache may grow to
+  uint64 minfree;         // free pages below which it shrinks instead
+  int nhot;               // hot buffers; changed with atomic instructions
+  struct {
+    uint dev;
+    uint blockno;
+  } ghost[NGHOST];        // cold blocks evicted lately, by GHOST()
+  uint64 nmiss;
+  uint64 nreadahead;      // changed with atomic instructions
+  uint64 nevict;
+  uint64 nevictcontended;
 } bcache;
 
+// Put b at the most recently used end of bk's list.
+static void
+pushfront(struct bucket *bk, struct buf *b)
+{
+  b->next = bk->head.next;
+  b->prev = &bk->head;
+  bk->head.next->prev = b;
+  bk->head.next = b;
+}
+
+// Put b at the least recently used end of bk's list.
+static void
+pushback(struct bucket *bk, struct buf *b)
+{
+  b->next = &bk->head;
+  b->prev = bk->head.prev;
+  bk->head.prev->next = b;
+  bk->head.prev = b;
+}
+
+static void
+unlinkbuf(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
 void
 binit(void)
 {
+  struct bucket *bk;
   struct buf *b;
+  uint64 free;
 
   initlock(&bcache.lock, "bcache");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    pushfront(&bcache.bucket[EMPTY], b);
   }
+  bcache.nbuf = NBUF;
+
+  // give the cache at most a quarter of memory, and
+  // stop it growing once less than a sixteenth is free.
+  free = kfreepages();
+  bcache.max = BCACHEMAX;
+  if(bcache.max > free / 4 * CHUNKBUFS)
+    bcache.max = free / 4 * CHUNKBUFS;
+  if(bcache.max < NBUF)
+    bcache.max = NBUF;
+  bcache.minfree = free / 16;
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
+// Acquire a bucket's lock, counting how often it was
+// already held.
+static void
+lockbucket(struct bucket *bk)
+{
+  int contended = 0;
+
+  if(!tryacquire(&bk->lock)){
+    contended = 1;
+    acquire(&bk->lock);
+  }
+  bk->nacquire++;
+  bk->ncontended += contended;
+}
+
+static struct bucket*
+bucketof(struct buf *b)
+{
+  return &bcache.bucket[HASH(b->dev, b->blockno)];
+}
+
+// Find the buffer for a block in bk, which is locked,
+// and take a reference to it. ra is set for readahead,
+// which isn't a use of the block.
 static struct buf*
-bget(uint dev, uint blockno)
+lookup(struct bucket *bk, uint dev, uint blockno, int ra)
 {
   struct buf *b;
 
-  acquire(&bcache.lock);
-
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = bk->head.next; b != &bk->head; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
+      if(!ra && b->refcnt == 0){
+        // a block read ahead hasn't been used yet, so
+        // its first use isn't a second one.
+        if(b->readahead){
+          b->readahead = 0;
+        } else if(!b->hot && b->lastuse != ticks){
+          b->hot = 1;
+          __sync_fetch_and_add(&bcache.nhot, 1);
+        }
+      }
       b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
+      if(!ra)
+        bk->nhit++;
       return b;
     }
   }
+  return 0;
+}
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+// Add a chunk of empty buffers to the cache, if it may
+// grow. Caller holds bcache.lock.
+static void
+grow(void)
+{
+  struct bucket *bk = &bcache.bucket[EMPTY];
+  struct bchunk *c;
+  int i;
+
+  if(bcache.nbuf + CHUNKBUFS > bcache.max)
+    return;
+  if((c = kalloc_zeroed()) == 0)
+    return;
+  c->next = bcache.chunks;
+  bcache.chunks = c;
+  lockbucket(bk);
+  for(i = 0; i < CHUNKBUFS; i++){
+    initsleeplock(&c->buf[i].lock, "buffer");
+    pushback(bk, &c->buf[i]);
+  }
+  release(&bk->lock);
+  bcache.nbuf += CHUNKBUFS;
+}
+
+// Free up to n chunks whose buffers are all unused.
+// returns the number freed. Caller holds bcache.lock.
+static int
+shrink(int n)
+{
+  struct bchunk *c, **pp;
+  struct bucket *bk;
+  struct buf *b;
+  int i, j, freed = 0;
+
+  for(pp = &bcache.chunks; (c = *pp) != 0 && freed < n; ){
+    // take the chunk's buffers off their lists, so no one
+    // can find them, and put them back if one is in use.
+    for(i = 0; i < CHUNKBUFS; i++){
+      b = &c->buf[i];
+      bk = bucketof(b);
+      lockbucket(bk);
+      if(b->refcnt != 0){
+        release(&bk->lock);
+        break;
+      }
+      unlinkbuf(b);
+      release(&bk->lock);
+    }
+    if(i < CHUNKBUFS){
+      for(j = 0; j < i; j++){
+        b = &c->buf[j];
+        bk = bucketof(b);
+        lockbucket(bk);
+        pushback(bk, b);
+        release(&bk->lock);
+      }
+      pp = &c->next;
+      continue;
+    }
+    for(i = 0; i < CHUNKBUFS; i++){
+      if(c->buf[i].hot)
+        __sync_fetch_and_sub(&bcache.nhot, 1);
     }
+    *pp = c->next;
+    bcache.nbuf -= CHUNKBUFS;
+    kfree(c);
+    freed++;
   }
-  panic("bget: no buffers");
+  return freed;
+}
+
+// Take the buffer to recycle out of its bucket; see the
+// comment at the top. Caller holds bcache.lock.
+static struct buf*
+evict(void)
+{
+  struct bucket *bk;
+  struct buf *b, *bc, *bh, *cold, *hot, *victim;
+  int i, ci, hi;
+
+  for(;;){
+    cold = hot = 0;
+    ci = hi = 0;
+    for(i = 0; i < NBUCKET; i++){
+      bk = &bcache.bucket[i];
+      lockbucket(bk);
+      // a bucket's least recently used unused cold and
+      // hot buffers are the last ones on its list.
+      bc = bh = 0;
+      for(b = bk->head.prev; b != &bk->head && (bc == 0 || bh == 0); b = b->prev){
+        if(b->refcnt != 0)
+          continue;
+        if(b->hot){
+          if(bh == 0)
+            bh = b;
+        } else if(bc == 0){
+          bc = b;
+        }
+      }
+      if(bc && (cold == 0 || (int)(bc->lastuse - cold->lastuse) < 0)){
+        cold = bc;
+        ci = i;
+      }
+      if(bh && (hot == 0 || (int)(bh->lastuse - hot->lastuse) < 0)){
+        hot = bh;
+        hi = i;
+      }
+      release(&bk->lock);
+    }
+
+    // an empty buffer is always the one to use.
+    if(cold && (!cold->valid || hot == 0 || bcache.nbuf - bcache.nhot > bcache.nbuf / 4)){
+      victim = cold;
+      bk = &bcache.bucket[ci];
+    } else if(hot){
+      victim = hot;
+      bk = &bcache.bucket[hi];
+    } else {
+      panic("bget: no buffers");
+    }
+
+    // the buckets were unlocked, so the victim may be in
+    // use by now; if so, look again.
+    lockbucket(bk);
+    if(victim->refcnt == 0)
+      break;
+    release(&bk->lock);
+  }
+  unlinkbuf(victim);
+  if(victim->hot){
+    victim->hot = 0;
+    __sync_fetch_and_sub(&bcache.nhot, 1);
+  } else if(victim->valid){
+    i = GHOST(victim->dev, victim->blockno);
+    bcache.ghost[i].dev = victim->dev;
+    bcache.ghost[i].blockno = victim->blockno;
+  }
+  release(&bk->lock);
+  return victim;
+}
+
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer.
+// In either case, return the buffer with a reference
+// but not locked. ra is set for readahead.
+static struct buf*
+bfind(uint dev, uint blockno, int ra)
+{
+  struct bucket *bk = &bcache.bucket[HASH(dev, blockno)];
+  struct buf *b;
+  int i;
+
+  lockbucket(bk);
+
+  // Is the block already cached?
+  if((b = lookup(bk, dev, blockno, ra)) != 0){
+    release(&bk->lock);
+    return b;
+  }
+  release(&bk->lock);
+
+  // Not cached.
+  // Only an eviction adds a block to a bucket, so once
+  // this one holds bcache.lock, the block can't appear
+  // unless it did while waiting.
+  if(!tryacquire(&bcache.lock)){
+    acquire(&bcache.lock);
+    bcache.nevictcontended++;
+  }
+  lockbucket(bk);
+  if((b = lookup(bk, dev, blockno, ra)) != 0){
+    release(&bk->lock);
+    release(&bcache.lock);
+    return b;
+  }
+  release(&bk->lock);
+  if(!ra)
+    bcache.nmiss++;
+
+  // Grow the cache while there's memory to spare;
+  // give some back when there isn't.
+  if(kfreepages() < bcache.minfree)
+    shrink(1);
+  else
+    grow();
+
+  // Recycle an unused buffer.
+  b = evict();
+  if(b->valid)
+    bcache.nevict++;
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  b->readahead = ra;
+  i = GHOST(dev, blockno);
+  if(!ra && bcache.ghost[i].dev == dev && bcache.ghost[i].blockno == blockno){
+    // evicted too soon last time.
+    bcache.ghost[i].dev = 0;
+    b->hot = 1;
+    __sync_fetch_and_add(&bcache.nhot, 1);
+  }
+  lockbucket(bk);
+  pushfront(bk, b);
+  release(&bk->lock);
+  release(&bcache.lock);
+  return b;
+}
+
+// Return a locked buffer for block on device dev.
+static struct buf*
+bget(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bfind(dev, blockno, 0);
+  acquiresleep(&b->lock);
+  return b;
+}
+
+// Drop a reference to b. If it was the last, move b to the
+// head of its bucket's most-recently-used list.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk = bucketof(b);
+
+  lockbucket(bk);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    // no one is waiting for it.
+    b->lastuse = ticks;
+    unlinkbuf(b);
+    pushfront(bk, b);
+  }
+  release(&bk->lock);
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -112,7 +469,6 @@ bwrite(struct buf *b)
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
 void
 brelse(struct buf *b)
 {
@@ -120,34 +476,111 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
+  bput(b);
+}
 
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+// Start reading a block into the cache without waiting for
+// it, for readahead. returns 0 if the read was started or
+// isn't needed, or -1 if the disk has no room for it now.
+int
+bprefetch(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bfind(dev, blockno, 1);
+  // if someone has the buffer locked, they are using the
+  // block or reading it in already.
+  if(b->valid || !tryacquiresleep(&b->lock)){
+    bput(b);
+    return 0;
+  }
+  if(b->valid){
+    releasesleep(&b->lock);
+    bput(b);
+    return 0;
+  }
+  if(virtio_disk_start(b) != 0){
+    releasesleep(&b->lock);
+    bput(b);
+    return -1;
+  }
+  // bdone() unlocks and releases b.
+  __sync_fetch_and_add(&bcache.nreadahead, 1);
+  return 0;
+}
+
+// Called from virtio_disk_intr() when a read started by
+// bprefetch() has finished.
+void
+bdone(struct buf *b)
+{
+  b->valid = 1;
+  releasesleep(&b->lock);
+  bput(b);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bucketof(b);
+
+  lockbucket(bk);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bucketof(b);
+
+  lockbucket(bk);
   b->refcnt--;
+  release(&bk->lock);
+}
+
+// Report the buffer cache's size, hit rate and lock statistics.
+void
+bstat(struct bcachestat *st)
+{
+  struct bucket *bk;
+  int i;
+
+  st->nhit = 0;
+  for(i = 0; i < NBUCKET; i++){
+    bk = &bcache.bucket[i];
+    acquire(&bk->lock);
+    st->nacquire[i] = bk->nacquire;
+    st->ncontended[i] = bk->ncontended;
+    st->nhit += bk->nhit;
+    release(&bk->lock);
+  }
+  acquire(&bcache.lock);
+  st->nbuf = bcache.nbuf;
+  st->maxbuf = bcache.max;
+  st->nmiss = bcache.nmiss;
+  st->nhot = bcache.nhot;
+  st->nreadahead = bcache.nreadahead;
+  st->nevict = bcache.nevict;
+  st->nevictcontended = bcache.nevictcontended;
   release(&bcache.lock);
 }
 
+// Called by kalloc() when memory runs out: give back
+// chunks of unused buffers. Returns the number of pages
+// freed.
+int
+breclaim(void)
+{
+  int n, mine;
+
+  // grow() may be the one calling kalloc().
+  push_off();
+  mine = holding(&bcache.lock);
+  pop_off();
+  if(mine)
+    return 0;
 
+  acquire(&bcache.lock);
+  n = shrink(RECLAIM);
+  release(&bcache.lock);
+  return n;
+}
@@ -5,7 +5,10 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  uint lastuse;     // ticks when refcnt last fell to 0
+  int hot;          // used again since it was read; see evict()
+  int readahead;    // read ahead, and not used since
+  struct buf *prev; // LRU list of the buf's hash bucket
   struct buf *next;
   uchar data[BSIZE];
 };
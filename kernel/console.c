@@ -83,7 +83,13 @@ consoleread(int user_dst, uint64 dst, int n)
   int c;
   char cbuf;
 
+  // a line is at most a buffer's worth, and vmprefault()
+  // may have to page in everything it's asked to.
+  if(n > INPUT_BUF)
+    n = INPUT_BUF;
   target = n;
+  if(user_dst)
+    vmprefault(dst, n, 1);
   acquire(&cons.lock);
   while(n > 0){
     // wait until interrupt handler has put some
@@ -1,13 +1,17 @@
+struct bcachestat;
 struct buf;
 struct context;
 struct file;
 struct inode;
+struct memstat;
+struct schedstat;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vma;
 
 // bio.c
 void            binit(void);
@@ -16,6 +20,10 @@ void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            bstat(struct bcachestat*);
+int             bprefetch(uint, uint);
+void            bdone(struct buf*);
+int             breclaim(void);
 
 // console.c
 void            consoleinit(void);
@@ -46,6 +54,7 @@ void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
+uint            iprefetch(struct inode*, uint, uint);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
@@ -54,6 +63,11 @@ void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
 
+// futex.c
+void            futexinit(void);
+int             futexwait(uint64, int);
+int             futexwake(uint64, int);
+
 // ramdisk.c
 void            ramdiskinit(void);
 void            ramdiskintr(void);
@@ -62,7 +76,16 @@ void            ramdiskrw(struct buf*);
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
+void            kdup(void *);
+int             krefcount(void *);
+void*           kalloc_zeroed(void);
+void*           kalloc_order(int);
+void            kfree_order(void *, int);
+void            ksplit(void *, int);
 void            kinit(void);
+void            kmemstat(struct memstat*);
+uint64          kfreepages(void);
+int             kidlezero(void);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -70,6 +93,24 @@ void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
 
+// mmap.c
+struct vma*     findvma(struct proc*, uint64);
+uint64          vmabottom(struct proc*);
+uint64          mmap(uint64, uint64, int, int, struct file*, uint64);
+int             munmap(uint64, uint64);
+int             vmafault(struct proc*, uint64, int);
+int             vmacopy(struct proc*, struct proc*);
+void            vmafree(struct proc*);
+
+// pcache.c
+void            pcacheinit(void);
+char*           pcacheget(struct inode*, uint, uint);
+void            pcacheput(struct inode*, uint, uint, char*);
+char*           pcacheread(struct inode*, uint, uint);
+void            pcacheinval(struct inode*);
+int             pcachereclaim(void);
+int             pcachecount(void);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
@@ -85,10 +126,11 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
-int             growproc(int);
-void            proc_mapstacks(pagetable_t);
+uint64          growproc(int);
+int             clone(uint64, uint64, uint64);
+int             join(uint64);
 pagetable_t     proc_pagetable(struct proc *);
-void            proc_freepagetable(pagetable_t, uint64);
+void            proc_freepagetable(pagetable_t, uint64, uint64);
 int             kill(int);
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
@@ -104,21 +146,31 @@ void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+void            schedstats(struct schedstat*);
+int             setpriority(int, int);
+int             getpriority(int);
+int             setaffinity(int, uint64);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
 
+// usercopy.S
+int             ucopy(char*, char*, uint64);
+int             ucopystr(char*, char*, uint64);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
+int             tryacquire(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
+int             tryacquiresleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
@@ -139,12 +191,22 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// timer.c
+void            wheelinit(void);
+void            timerrun(uint);
+uint64          timernext(void);
+int             timersleep(int);
+
 // trap.c
 extern uint     ticks;
+extern uint64   ntimerintr;
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
+void            ipi(int);
+uint            tickupdate(void);
+void            timerarm(uint64);
 
 // uart.c
 void            uartinit(void);
@@ -156,16 +218,32 @@ int             uartgetc(void);
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
+pagetable_t     kvmcreate(pagetable_t);
+void            kvmuser(pagetable_t, pagetable_t);
+void            kvmfree(pagetable_t);
+void            asidinit(void);
+void            kvmswitch(struct proc*);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
+int             kvmmapstack(uint64, uint64);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvminit(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcopyrange(pagetable_t, pagetable_t, uint64, uint64, int);
+int             uvmcow(pagetable_t, uint64);
+int             vmfault(pagetable_t, uint64, int);
+void            vmprefault(uint64, uint64, int);
+void            uvmflush(pagetable_t, uint64, uint64);
+void            uvmipi(void);
+uint64          uvmresident(pagetable_t, uint64);
+uint64          uvmsuperpages(pagetable_t);
 void            uvmfree(pagetable_t, uint64);
-void            uvmunmap(pagetable_t, uint64, uint64, int);
+int             uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+pte_t*          walk(pagetable_t, uint64, int);
+pte_t*          walklevel(pagetable_t, uint64, int, int*);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
@@ -180,6 +258,7 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+int             virtio_disk_start(struct buf *);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
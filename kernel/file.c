@@ -101,11 +101,43 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// Sequential readahead, for a read of n > 0 bytes at off
+// from f, whose inode is locked. A read that starts where the
+// last one ended is sequential. Each time fewer than half a
+// window of blocks beyond a sequential read are cached or on
+// their way, the file's readahead window doubles, from RAMIN
+// blocks up to RAMAX, and the reads of the blocks up to a
+// window past this read are started, so the disk works ahead
+// of the reader. Any other read closes the window.
+static void
+readahead(struct file *f, uint off, uint n)
+{
+  uint first, last;
+
+  if(off != f->ranext){
+    f->rawin = 0;
+    f->raend = 0;
+    return;
+  }
+  first = off / BSIZE;
+  last = (off + n - 1) / BSIZE;
+  if(f->raend < first)
+    f->raend = first;
+  if(f->rawin > 0 && f->raend > last + f->rawin / 2)
+    return;
+  if(f->rawin == 0)
+    f->rawin = RAMIN;
+  else if(f->rawin < RAMAX)
+    f->rawin *= 2;
+  f->raend += iprefetch(f->ip, f->raend, last + 1 + f->rawin - f->raend);
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
 fileread(struct file *f, uint64 addr, int n)
 {
+  uint off, size;
   int r = 0;
 
   if(f->readable == 0)
@@ -118,9 +150,23 @@ fileread(struct file *f, uint64 addr, int n)
       return -1;
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
+    // don't page in more of the buffer than readi() can fill,
+    // which matters when vmprefault() has to page in all of
+    // it. the size and offset are read without the inode
+    // lock; if the file grows meanwhile, the read is short.
+    off = f->off;
+    size = f->ip->size;
+    if(n < 0 || off >= size)
+      n = 0;
+    else if(n > size - off)
+      n = size - off;
+    vmprefault(addr, n, 1);
     ilock(f->ip);
+    if(n > 0)
+      readahead(f, f->off, n);
     if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
       f->off += r;
+    f->ranext = f->off;
     iunlock(f->ip);
   } else {
     panic("fileread");
@@ -154,6 +200,7 @@ filewrite(struct file *f, uint64 addr, int n)
     // might be writing a device like the console.
     int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
     int i = 0;
+    vmprefault(addr, n, 0);
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
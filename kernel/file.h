@@ -6,6 +6,9 @@ struct file {
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
+  uint ranext;       // FD_INODE: offset a sequential read would start at
+  uint rawin;        // FD_INODE: readahead window, in blocks; see readahead()
+  uint raend;        // FD_INODE: block after the last one read ahead
   short major;       // FD_DEVICE
 };
 
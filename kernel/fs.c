@@ -413,6 +413,7 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  pcacheinval(ip);
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -476,6 +477,24 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   return tot;
 }
 
+// Start reading up to n of ip's data blocks, from block bn
+// on, into the buffer cache without waiting, for readahead.
+// returns the number of blocks now cached or on their way,
+// fewer than n at the end of the file or if the disk is busy.
+// Caller must hold ip->lock.
+uint
+iprefetch(struct inode *ip, uint bn, uint n)
+{
+  uint i, end;
+
+  end = (ip->size + BSIZE - 1) / BSIZE;
+  for(i = 0; i < n && bn + i < end; i++){
+    if(bprefetch(ip->dev, bmap(ip, bn + i)) != 0)
+      break;
+  }
+  return i;
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -494,6 +513,7 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  pcacheinval(ip);
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
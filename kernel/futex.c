@@ -0,0 +1,159 @@
+//
+// Futexes: wait queues for user words, on which user-space
+// locks (see mutex_lock() in user/ulib.c) sleep only when
+// they are contended.
+//
+// A futex is named by the process's space and the user address
+// of its word, so the threads of a process find the same queue,
+// while a fork()ed child, whose copy of the word is its own once
+// either writes it, finds another. A word in a MAP_SHARED region
+// may be mapped at other addresses by other processes, so it is
+// named by its physical address instead; fork() doesn't make
+// such pages copy-on-write, so the word can't move. The queues
+// are hashed on the name; futexwait() checks the word under its
+// queue's lock, so a futexwake() that follows a change to the
+// word can't be missed.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "space.h"
+#include "fcntl.h"
+#include "defs.h"
+
+#define NFUTEX 61
+#define FUTEXHASH(space, key) ((((uint64)(space) >> 6) + ((key) >> 2)) % NFUTEX)
+
+struct waiter {
+  struct space *space;    // the space of a private futex, or 0
+  uint64 key;             // the word's user address, or physical if shared
+  struct waiter *next;    // next waiter in the same queue
+  int woken;
+};
+
+struct {
+  struct spinlock lock;
+  struct waiter *head;    // oldest waiter first
+} futexq[NFUTEX];
+
+void
+futexinit(void)
+{
+  for(int i = 0; i < NFUTEX; i++)
+    initlock(&futexq[i].lock, "futex");
+}
+
+// Find the name of the futex at addr in the current process,
+// and page the word in, so that futexwait() can read it while
+// holding a spinlock. returns 0, or -1 if addr is bad.
+static int
+futexkey(uint64 addr, struct space **space, uint64 *key)
+{
+  struct proc *p = myproc();
+  struct space *s = p->space;
+  struct vma *v;
+  pte_t *pte;
+  uint64 pa;
+  int locked, r = 0;
+
+  if(addr % sizeof(int) != 0 || addr >= MAXUVA)
+    return -1;
+  pte = walk(p->pagetable, addr, 0);
+  if(pte == 0 || (*pte & (PTE_V|PTE_U|PTE_W)) != (PTE_V|PTE_U|PTE_W)){
+    if(vmfault(p->pagetable, addr, 1) != 0)
+      return -1;
+  }
+
+  // other threads may be changing the regions.
+  if((locked = s->ref > 1) != 0)
+    acquiresleep(&s->vmlock);
+  if((v = findvma(p, addr)) != 0 && (v->flags & MAP_SHARED)){
+    if((pa = walkaddr(p->pagetable, addr)) == 0)
+      r = -1;
+    *space = 0;
+    *key = pa + (addr & (PGSIZE-1));
+  } else {
+    *space = s;
+    *key = addr;
+  }
+  if(locked)
+    releasesleep(&s->vmlock);
+  return r;
+}
+
+// Sleep until a futexwake() on addr, if the int at addr
+// is still val. returns 0 once woken, or -1 if the word
+// had changed, addr is bad, or the process was killed.
+int
+futexwait(uint64 addr, int val)
+{
+  struct proc *p = myproc();
+  struct waiter w, **pp;
+  struct space *space;
+  uint64 key;
+  int cur, h;
+
+  if(futexkey(addr, &space, &key) != 0)
+    return -1;
+  h = FUTEXHASH(space, key);
+  acquire(&futexq[h].lock);
+  // futexkey() paged the word in, so this can't sleep, but
+  // it can fail if another thread unmapped it since.
+  if(copyin(p->pagetable, (char*)&cur, addr, sizeof(cur)) != 0 || cur != val){
+    release(&futexq[h].lock);
+    return -1;
+  }
+  w.space = space;
+  w.key = key;
+  w.next = 0;
+  w.woken = 0;
+  for(pp = &futexq[h].head; *pp; pp = &(*pp)->next)
+    ;
+  *pp = &w;
+  while(!w.woken){
+    if(p->killed){
+      for(pp = &futexq[h].head; *pp != &w; pp = &(*pp)->next)
+        ;
+      *pp = w.next;
+      release(&futexq[h].lock);
+      return -1;
+    }
+    sleep(&w, &futexq[h].lock);
+  }
+  release(&futexq[h].lock);
+  return 0;
+}
+
+// Wake up to n of the threads waiting on the word at addr,
+// oldest first. returns the number woken, or -1.
+int
+futexwake(uint64 addr, int n)
+{
+  struct waiter *w, **pp;
+  struct space *space;
+  uint64 key;
+  int h, woken;
+
+  if(futexkey(addr, &space, &key) != 0)
+    return -1;
+  h = FUTEXHASH(space, key);
+  woken = 0;
+  acquire(&futexq[h].lock);
+  for(pp = &futexq[h].head; (w = *pp) != 0 && woken < n; ){
+    if(w->space != space || w->key != key){
+      pp = &w->next;
+      continue;
+    }
+    *pp = w->next;
+    w->woken = 1;
+    wakeup(w);
+    woken++;
+  }
+  release(&futexq[h].lock);
+  return woken;
+}
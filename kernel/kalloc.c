@@ -1,14 +1,57 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates blocks of 2^order
+// physically contiguous 4096-byte pages.
+//
+// The global pool (kmem) is a binary buddy allocator:
+// a free block of order k is 2^k pages long, aligned to
+// its own size, and sits on kmem.free[k]. Allocation
+// splits larger blocks; freeing merges a block with its
+// buddy (the other half of the order k+1 block containing
+// it) whenever the buddy is also free.
+//
+// Single pages are by far the most common request, so
+// each CPU also caches free pages on a list hanging off
+// its struct cpu, and kalloc() and kfree() normally touch
+// only CPU-local state. A CPU refills its cache from kmem
+// KBATCH pages at a time, and gives KBATCH pages back when
+// its cache grows past KCACHEMAX. A CPU that finds both its
+// cache and kmem empty steals half of some other CPU's cache.
+//
+// Every allocated page has a reference count, so that
+// pages can be shared copy-on-write between processes
+// (see uvmcopy()). kalloc() sets it to one, kdup() adds a
+// reference, and kfree() only frees the page when the last
+// reference goes away. For a block from kalloc_order(),
+// the count of its first page stands for the whole block.
+//
+// Freed pages are not cleared. Callers that need zeroed
+// memory use kalloc_zeroed(), which takes pages from a
+// pool (kzero) that idle CPUs fill in the background; see
+// kidlezero(). Build with KMEMDEBUG to fill allocated and
+// freed pages with junk, to catch uninitialized memory and
+// dangling references.
 
 #include "types.h"
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
 #include "riscv.h"
+#include "proc.h"
+#include "memstat.h"
 #include "defs.h"
 
+#define KBATCH     32            // pages moved between a CPU and kmem at once
+#define KCACHEMAX  (2*KBATCH)    // drain a CPU's cache beyond this many pages
+#define ZPOOLMAX   256           // pre-zeroed pages kept for kalloc_zeroed()
+#define ZBATCH     8             // pages zeroed per call of kidlezero()
+
+#define NPAGES     ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PA2PG(pa)  (((uint64)(pa) - KERNBASE) / PGSIZE)
+
+// kmem.state[] of the first page of a free buddy block.
+#define PG_FREE    0x80          // or'd with the block's order
+
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel.
@@ -16,50 +59,320 @@ extern char end[]; // first address after kernel.
 
 struct run {
   struct run *next;
+  struct run *prev;  // only used on kmem.free[] lists
 };
 
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  uint64 base;                  // first page managed by the buddy allocator
+  struct run free[MAXORDER+1];  // circular lists of free blocks, by order
+  int nfree[MAXORDER+1];        // length of each free[] list
+  uchar state[NPAGES];          // PG_FREE|order at the head of each free block
 } kmem;
 
+// reference counts of allocated pages, indexed by PA2PG().
+// updated with atomic instructions rather than a lock.
+int pageref[NPAGES];
+
+// free pages that have already been zeroed.
+struct {
+  struct spinlock lock;
+  struct run *freelist;
+  int n;
+} kzero;
+
+static void
+listinit(struct run *head)
+{
+  head->next = head;
+  head->prev = head;
+}
+
+static void
+listpush(struct run *head, struct run *r)
+{
+  r->next = head->next;
+  r->prev = head;
+  head->next->prev = r;
+  head->next = r;
+}
+
+static void
+listremove(struct run *r)
+{
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+}
+
 void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
+  initlock(&kzero.lock, "kzero");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&cpus[i].kmemlock, "kmemcpu");
+  for(int k = 0; k <= MAXORDER; k++)
+    listinit(&kmem.free[k]);
+  kmem.base = PGROUNDUP((uint64)end);
   freerange(end, (void*)PHYSTOP);
 }
 
+// Put a block on its free list without trying to merge it.
+// Caller must hold kmem.lock.
+static void
+bpush(uint64 pa, int order)
+{
+  listpush(&kmem.free[order], (struct run*)pa);
+  kmem.nfree[order]++;
+  kmem.state[PA2PG(pa)] = PG_FREE | order;
+}
+
+// Seed the buddy allocator with [pa_start, pa_end), cut
+// into the largest naturally aligned blocks that fit.
 void
 freerange(void *pa_start, void *pa_end)
 {
-  char *p;
-  p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  uint64 p, e;
+  int order;
+
+  p = PGROUNDUP((uint64)pa_start);
+  e = PGROUNDDOWN((uint64)pa_end);
+  acquire(&kmem.lock);
+  while(p < e){
+    order = MAXORDER;
+    while(order > 0 && ((p % (PGSIZE << order)) != 0 || p + (PGSIZE << order) > e))
+      order--;
+    bpush(p, order);
+    p += PGSIZE << order;
+  }
+  release(&kmem.lock);
+}
+
+// Take a block of the given order from the buddy lists,
+// splitting a larger block if necessary.
+// Caller must hold kmem.lock.
+static uint64
+balloc(int order)
+{
+  struct run *r;
+  int k;
+
+  for(k = order; k <= MAXORDER; k++)
+    if(kmem.nfree[k] > 0)
+      break;
+  if(k > MAXORDER)
+    return 0;
+
+  r = kmem.free[k].next;
+  listremove(r);
+  kmem.nfree[k]--;
+  kmem.state[PA2PG(r)] = 0;
+
+  // hand the upper halves back until the block is small enough.
+  while(k > order){
+    k--;
+    bpush((uint64)r + (PGSIZE << k), k);
+  }
+  return (uint64)r;
+}
+
+// Return a block to the buddy lists, merging it with its
+// buddy for as long as the buddy is free too.
+// Caller must hold kmem.lock.
+static void
+bfree(uint64 pa, int order)
+{
+  uint64 buddy;
+
+  while(order < MAXORDER){
+    buddy = pa ^ (PGSIZE << order);
+    if(buddy < kmem.base || buddy + (PGSIZE << order) > PHYSTOP)
+      break;
+    if(kmem.state[PA2PG(buddy)] != (PG_FREE | order))
+      break;
+    listremove((struct run*)buddy);
+    kmem.nfree[order]--;
+    kmem.state[PA2PG(buddy)] = 0;
+    if(buddy < pa)
+      pa = buddy;
+    order++;
+  }
+  bpush(pa, order);
+}
+
+// Detach up to n pages from the front of *list.
+// Returns the detached chain, and its last element in *tail.
+static struct run*
+takepages(struct run **list, int n, struct run **tail, int *got)
+{
+  struct run *head, *r;
+  int i;
+
+  head = *list;
+  if(head == 0){
+    *got = 0;
+    return 0;
+  }
+  r = head;
+  for(i = 1; i < n && r->next; i++)
+    r = r->next;
+  *list = r->next;
+  r->next = 0;
+  *tail = r;
+  *got = i;
+  return head;
+}
+
+// Take half of some other CPU's cached pages.
+// Returns the chain, with its length in *got.
+static struct run*
+steal(struct cpu *c, struct run **tail, int *got)
+{
+  struct run *r;
+
+  for(struct cpu *v = cpus; v < &cpus[NCPU]; v++){
+    if(v == c)
+      continue;
+    acquire(&v->kmemlock);
+    r = takepages(&v->kmemfree, (v->nkmemfree + 1) / 2, tail, got);
+    v->nkmemfree -= *got;
+    release(&v->kmemlock);
+    if(r)
+      return r;
+  }
+  *got = 0;
+  return 0;
+}
+
+// c's cache is empty. Refill it with a batch of pages,
+// from kmem if possible, otherwise from another CPU.
+// Returns one page for the caller, or 0 if there is
+// no free memory anywhere.
+// Interrupts must be disabled.
+static struct run*
+refill(struct cpu *c)
+{
+  struct run *r, *tail, *p;
+  int got;
+
+  r = tail = 0;
+  acquire(&kmem.lock);
+  for(got = 0; got < KBATCH; got++){
+    if((p = (struct run*)balloc(0)) == 0)
+      break;
+    p->next = r;
+    r = p;
+    if(tail == 0)
+      tail = p;
+  }
+  release(&kmem.lock);
+
+  if(r == 0)
+    r = steal(c, &tail, &got);
+  if(r == 0){
+    // last resort: a page from the zeroed pool.
+    acquire(&kzero.lock);
+    r = takepages(&kzero.freelist, 1, &tail, &got);
+    kzero.n -= got;
+    release(&kzero.lock);
+  }
+  if(r == 0)
+    return 0;
+
+  if(got > 1){
+    acquire(&c->kmemlock);
+    tail->next = c->kmemfree;
+    c->kmemfree = r->next;
+    c->nkmemfree += got - 1;
+    release(&c->kmemlock);
+  }
+  return r;
+}
+
+// Give every CPU's cached pages, and the zeroed pool,
+// back to the buddy allocator, so that they can merge
+// into larger blocks.
+static void
+drainall(void)
+{
+  struct run *r, *next;
+
+  acquire(&kzero.lock);
+  r = kzero.freelist;
+  kzero.freelist = 0;
+  kzero.n = 0;
+  release(&kzero.lock);
+  acquire(&kmem.lock);
+  for(; r; r = next){
+    next = r->next;
+    bfree((uint64)r, 0);
+  }
+  release(&kmem.lock);
+
+  for(struct cpu *c = cpus; c < &cpus[NCPU]; c++){
+    acquire(&c->kmemlock);
+    r = c->kmemfree;
+    c->kmemfree = 0;
+    c->nkmemfree = 0;
+    release(&c->kmemlock);
+    if(r == 0)
+      continue;
+    acquire(&kmem.lock);
+    for(; r; r = next){
+      next = r->next;
+      bfree((uint64)r, 0);
+    }
+    release(&kmem.lock);
+  }
 }
 
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// call to kalloc().
 void
 kfree(void *pa)
 {
-  struct run *r;
+  struct run *r, *batch, *tail;
+  struct cpu *c;
+  int got, ref;
 
-  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+  if(((uint64)pa % PGSIZE) != 0 || (uint64)pa < kmem.base || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  if((ref = __sync_sub_and_fetch(&pageref[PA2PG(pa)], 1)) > 0)
+    return;  // still shared.
+  if(ref < 0)
+    panic("kfree: ref");
+
+#ifdef KMEMDEBUG
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
+  batch = 0;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  c = mycpu();
+  acquire(&c->kmemlock);
+  r->next = c->kmemfree;
+  c->kmemfree = r;
+  c->nkmemfree++;
+  if(c->nkmemfree > KCACHEMAX){
+    batch = takepages(&c->kmemfree, KBATCH, &tail, &got);
+    c->nkmemfree -= got;
+  }
+  release(&c->kmemlock);
+
+  if(batch){
+    acquire(&kmem.lock);
+    for(r = batch; r; r = batch){
+      batch = r->next;
+      bfree((uint64)r, 0);
+    }
+    release(&kmem.lock);
+  }
+  pop_off();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -69,14 +382,231 @@ void *
 kalloc(void)
 {
   struct run *r;
+  struct cpu *c;
+
+  push_off();
+  c = mycpu();
+  acquire(&c->kmemlock);
+  r = c->kmemfree;
+  if(r){
+    c->kmemfree = r->next;
+    c->nkmemfree--;
+  }
+  release(&c->kmemlock);
+  if(r == 0)
+    r = refill(c);
+  pop_off();
+
+  if(r == 0){
+    // out of memory: take back the page cache's unused
+    // pages, or shrink the buffer cache.
+    if(pcachereclaim() > 0 || breclaim() > 0)
+      return kalloc();
+    return 0;
+  }
+  pageref[PA2PG(r)] = 1;
+#ifdef KMEMDEBUG
+  memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
+  return (void*)r;
+}
+
+// Add a reference to the allocated page (or block) at pa.
+void
+kdup(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (uint64)pa < kmem.base || (uint64)pa >= PHYSTOP)
+    panic("kdup");
+  if(__sync_fetch_and_add(&pageref[PA2PG(pa)], 1) < 1)
+    panic("kdup: free page");
+}
+
+// Return the number of references to the page at pa.
+int
+krefcount(void *pa)
+{
+  return __atomic_load_n(&pageref[PA2PG(pa)], __ATOMIC_SEQ_CST);
+}
+
+// Allocate one zeroed 4096-byte page of physical memory.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
+
+  acquire(&kzero.lock);
+  r = kzero.freelist;
+  if(r){
+    kzero.freelist = r->next;
+    kzero.n--;
+  }
+  release(&kzero.lock);
+
+  if(r){
+    r->next = 0;  // the only non-zero word.
+    pageref[PA2PG(r)] = 1;
+    return (void*)r;
+  }
+  if((r = kalloc()) != 0)
+    memset((char*)r, 0, PGSIZE);
+  return (void*)r;
+}
+
+// Called by scheduler() when this CPU has nothing to run.
+// Zeroes a few free pages for kalloc_zeroed(), unless the
+// pool is full or free memory is scarce.
+// Returns the number of pages zeroed.
+int
+kidlezero(void)
+{
+  struct run *r, *batch, *tail;
+  uint64 nfree;
+  int n;
+
+  if(kzero.n >= ZPOOLMAX)
+    return 0;
 
+  // leave the buddy allocator plenty of pages to work with.
+  nfree = 0;
   acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+  for(int k = 0; k <= MAXORDER; k++)
+    nfree += (uint64)kmem.nfree[k] << k;
   release(&kmem.lock);
+  if(nfree < 2*ZPOOLMAX)
+    return 0;
 
-  if(r)
-    memset((char*)r, 5, PGSIZE); // fill with junk
-  return (void*)r;
+  batch = tail = 0;
+  for(n = 0; n < ZBATCH; n++){
+    if((r = kalloc()) == 0)
+      break;
+    memset((char*)r, 0, PGSIZE);
+    pageref[PA2PG(r)] = 0;  // free again, as far as kdup() knows.
+    r->next = batch;
+    batch = r;
+    if(tail == 0)
+      tail = r;
+  }
+  if(batch == 0)
+    return 0;
+
+  acquire(&kzero.lock);
+  tail->next = kzero.freelist;
+  kzero.freelist = batch;
+  kzero.n += n;
+  release(&kzero.lock);
+  return n;
+}
+
+// Free a block of 2^order pages that was returned
+// by kalloc_order(order).
+void
+kfree_order(void *pa, int order)
+{
+  if(order == 0){
+    kfree(pa);
+    return;
+  }
+  if(order < 0 || order > MAXORDER || ((uint64)pa % (PGSIZE << order)) != 0 ||
+     (uint64)pa < kmem.base || (uint64)pa + (PGSIZE << order) > PHYSTOP)
+    panic("kfree_order");
+
+  if(__sync_sub_and_fetch(&pageref[PA2PG(pa)], 1) > 0)
+    return;
+
+#ifdef KMEMDEBUG
+  memset(pa, 1, PGSIZE << order);
+#endif
+
+  acquire(&kmem.lock);
+  bfree((uint64)pa, order);
+  release(&kmem.lock);
+}
+
+// Split the block of 2^order pages at pa, from kalloc_order(),
+// into separate pages, each of which must later be freed with
+// kfree(). Each page gets the reference count of the block.
+void
+ksplit(void *pa, int order)
+{
+  uint64 pg = PA2PG(pa);
+  int i;
+
+  for(i = 1; i < (1 << order); i++)
+    pageref[pg + i] = pageref[pg];
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to their total size. Returns 0 if there is no free
+// block that large.
+void *
+kalloc_order(int order)
+{
+  uint64 pa;
+
+  if(order == 0)
+    return kalloc();
+  if(order < 0 || order > MAXORDER)
+    return 0;
+
+  acquire(&kmem.lock);
+  pa = balloc(order);
+  release(&kmem.lock);
+
+  if(pa == 0){
+    // pages parked in per-CPU caches or the zeroed pool
+    // may complete a block.
+    drainall();
+    acquire(&kmem.lock);
+    pa = balloc(order);
+    release(&kmem.lock);
+  }
+
+  if(pa == 0)
+    return 0;
+  pageref[PA2PG(pa)] = 1;
+#ifdef KMEMDEBUG
+  memset((char*)pa, 5, PGSIZE << order);
+#endif
+  return (void*)pa;
+}
+
+// Roughly how many pages are free, read without locks;
+// for heuristics such as whether the buffer cache should grow.
+uint64
+kfreepages(void)
+{
+  uint64 n = kzero.n;
+
+  for(struct cpu *c = cpus; c < &cpus[NCPU]; c++)
+    n += c->nkmemfree;
+  for(int k = 0; k <= MAXORDER; k++)
+    n += (uint64)kmem.nfree[k] << k;
+  return n;
+}
+
+// Fill in a report of free memory and how fragmented it is.
+void
+kmemstat(struct memstat *st)
+{
+  uint64 cached = 0;
+
+  for(struct cpu *c = cpus; c < &cpus[NCPU]; c++){
+    acquire(&c->kmemlock);
+    cached += c->nkmemfree;
+    release(&c->kmemlock);
+  }
+
+  acquire(&kzero.lock);
+  st->zeroedpages = kzero.n;
+  release(&kzero.lock);
+
+  acquire(&kmem.lock);
+  st->freepages = cached + st->zeroedpages;
+  st->cachedpages = cached;
+  for(int k = 0; k <= MAXORDER; k++){
+    st->nfree[k] = kmem.nfree[k];
+    st->freepages += (uint64)kmem.nfree[k] << k;
+  }
+  release(&kmem.lock);
 }
@@ -19,13 +19,17 @@ main()
     kinit();         // physical page allocator
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
+    asidinit();      // address-space identifiers
     procinit();      // process table
     trapinit();      // trap vectors
+    wheelinit();     // timers for sleep()
+    futexinit();     // futex wait queues
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode table
+    pcacheinit();    // executable page cache
     fileinit();      // file table
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
@@ -29,6 +29,14 @@
 #define CLINT 0x2000000L
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid)) // software interrupt pending
+
+// the CLINT's physical address is inside user memory (see
+// MAXUVA), so the kernel maps it here instead, to send IPIs
+// with ipi() and to set its own timer with timerarm().
+#define KCLINT (0x40000000L + CLINT)
+#define KCLINT_MSIP(hartid) (KCLINT + 4*(hartid))
+#define KCLINT_MTIMECMP(hartid) (KCLINT + 0x4000 + 8*(hartid))
 
 // qemu puts platform-level interrupt controller (PLIC) here.
 #define PLIC 0x0c000000L
@@ -51,10 +59,6 @@
 // in both user and kernel space.
 #define TRAMPOLINE (MAXVA - PGSIZE)
 
-// map kernel stacks beneath the trampoline,
-// each surrounded by invalid guard pages.
-#define KSTACK(p) (TRAMPOLINE - ((p)+1)* 2*PGSIZE)
-
 // User memory layout.
 // Address zero first:
 //   text
@@ -62,6 +66,27 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   mmap() regions
+//   MAXUVA
+//   ...
+//   TRAPFRAMEN(NTHREAD-1)
+//   ...
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+// the threads of a process (see clone()) share a page table,
+// so each has its trapframe at a different address.
+#define TRAPFRAMEN(i) (TRAPFRAME - (i)*PGSIZE)
+
+// map kernel stacks beneath the trapframes, each surrounded
+// by invalid guard pages. user memory and the kernel's share
+// an ASID, so a kernel stack mustn't be at a trapframe's
+// address, or a stale TLB entry for one could be used for
+// the other.
+#define KSTACK(p) (TRAPFRAMEN(NTHREAD) - ((p)+1)* 2*PGSIZE)
+
+// each process's kernel page table also maps its user memory,
+// at the same addresses, so user memory has to end below the
+// lowest device the kernel maps.
+#define MAXUVA PLIC
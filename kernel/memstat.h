@@ -0,0 +1,9 @@
+// Physical memory statistics, filled in by the memstat() system call.
+// Needs param.h for MAXORDER.
+struct memstat {
+  uint64 freepages;           // free pages, including per-CPU caches
+  uint64 cachedpages;         // free pages sitting in per-CPU caches
+  uint64 zeroedpages;         // free pages already zeroed for kalloc_zeroed()
+  uint64 pcachepages;         // pages held by the executable page cache
+  uint64 nfree[MAXORDER+1];   // free buddy blocks of each order
+};
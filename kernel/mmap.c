@@ -0,0 +1,470 @@
+//
+// Memory-mapped files and anonymous memory: mmap() and munmap().
+//
+// Each process has a table of regions (vma[] in its struct space)
+// that live above its heap, allocated downwards from MAXUVA.
+// Threads that share the table change it only with the space's
+// vmlock held.
+// mmap() only records a region; vmafault() fills in its pages
+// as they are touched:
+//
+// * anonymous pages start out zeroed.
+// * MAP_PRIVATE file pages come from the page cache (pcache.c)
+//   and are mapped copy-on-write if the region is writable.
+// * MAP_SHARED file pages are read into a page of their own.
+//   They are mapped read-only at first; the first write to one
+//   marks it dirty (PTE_D), and dirty pages are written back to
+//   the file by munmap() and exit(). munmap() writes them only
+//   after letting go of the vmlock, since writing takes the
+//   file's inode lock.
+//
+// fork() gives the child the same regions. MAP_SHARED pages stay
+// shared between parent and child; others become copy-on-write.
+// Separate mmap()s of a file don't share pages, so processes that
+// don't share an ancestor's mapping only see each other's changes
+// once they have been written back.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "memlayout.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "space.h"
+#include "file.h"
+#include "fcntl.h"
+
+static int
+prot2perm(int prot)
+{
+  int perm = 0;
+  if(prot & (PROT_READ|PROT_WRITE))
+    perm |= PTE_R;
+  if(prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(prot & PROT_EXEC)
+    perm |= PTE_X;
+  return perm;
+}
+
+// the region of p containing va, or 0.
+struct vma*
+findvma(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->space->vma; v < &p->space->vma[NVMA]; v++){
+    if(v->len && va >= v->addr && va < v->addr + v->len)
+      return v;
+  }
+  return 0;
+}
+
+// the lowest address used by p's regions, or MAXUVA.
+// the heap may not grow past it.
+uint64
+vmabottom(struct proc *p)
+{
+  struct vma *v;
+  uint64 bottom = MAXUVA;
+
+  for(v = p->space->vma; v < &p->space->vma[NVMA]; v++){
+    if(v->len && v->addr < bottom)
+      bottom = v->addr;
+  }
+  return bottom;
+}
+
+// does [addr, addr+len) overlap any of p's regions?
+static struct vma*
+overlap(struct proc *p, uint64 addr, uint64 len)
+{
+  struct vma *v;
+
+  for(v = p->space->vma; v < &p->space->vma[NVMA]; v++){
+    if(v->len && addr < v->addr + v->len && v->addr < addr + len)
+      return v;
+  }
+  return 0;
+}
+
+// Dirty MAP_SHARED pages that munmap() has unmapped, each with
+// a reference to the page and to its file, for it to write back
+// once it has let go of the vmlock; see munmap().
+struct dirtypages {
+  struct dirtypages *next;
+  int n;
+  struct {
+    struct file *f;
+    uint64 pa;
+    uint64 off;
+  } pg[(PGSIZE - 16) / 24];
+};
+
+// Write the page at physical address pa back to ip at off.
+static void
+writepage(struct inode *ip, uint64 pa, uint64 off)
+{
+  // as in filewrite(), keep each transaction small.
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  uint n, m, i;
+
+  for(i = 0; i < PGSIZE; i += m){
+    begin_op();
+    ilock(ip);
+    // never extend the file.
+    n = 0;
+    if(off + i < ip->size)
+      n = ip->size - (off + i);
+    m = PGSIZE - i;
+    if(m > max)
+      m = max;
+    if(m > n)
+      m = n;
+    if(m > 0)
+      writei(ip, 0, pa + i, off + i, m);
+    iunlock(ip);
+    end_op();
+    if(m == 0)
+      break;
+  }
+}
+
+// Write the dirty pages of v in [start, end) back to its file.
+static void
+writeback(pagetable_t pagetable, struct vma *v, uint64 start, uint64 end)
+{
+  uint64 a;
+  pte_t *pte;
+
+  for(a = start; a < end; a += PGSIZE){
+    if((pte = walk(pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
+    if((*pte & PTE_D) == 0)
+      continue;
+    writepage(v->f->ip, PTE2PA(*pte), v->off + (a - v->addr));
+    *pte &= ~PTE_D;
+  }
+}
+
+// Add the dirty pages of v in [start, end) to *dp, for
+// munmap() to write back later. A page without PTE_D is
+// mapped read-only (see vmafault()), so it can't be dirtied
+// before it is unmapped without a fault, which would have to
+// wait for the vmlock. returns -1 if out of memory.
+static int
+keepdirty(pagetable_t pagetable, struct vma *v, uint64 start, uint64 end,
+          struct dirtypages **dp)
+{
+  struct dirtypages *d;
+  uint64 a, pa;
+  pte_t *pte;
+
+  for(a = start; a < end; a += PGSIZE){
+    if((pte = walk(pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
+    if((*pte & PTE_D) == 0)
+      continue;
+    if((d = *dp) == 0 || d->n == NELEM(d->pg)){
+      if((d = kalloc()) == 0)
+        return -1;
+      d->next = *dp;
+      d->n = 0;
+      *dp = d;
+    }
+    pa = PTE2PA(*pte);
+    kdup((void*)pa);
+    d->pg[d->n].f = filedup(v->f);
+    d->pg[d->n].pa = pa;
+    d->pg[d->n].off = v->off + (a - v->addr);
+    d->n++;
+  }
+  return 0;
+}
+
+// Remove [start, end) from region v: write back dirty
+// pages, or add them to *dp if dp isn't 0, free the pages,
+// and shrink, split or free v.
+// returns -1 if v has to be split and there is no free
+// slot for its upper part, or if out of memory.
+static int
+vmaunmap(struct proc *p, struct vma *v, uint64 start, uint64 end,
+         struct dirtypages **dp)
+{
+  struct vma *nv = 0;
+
+  if(start > v->addr && end < v->addr + v->len){
+    // a hole in the middle: the part above end needs a slot.
+    for(nv = p->space->vma; nv < &p->space->vma[NVMA]; nv++){
+      if(nv->len == 0)
+        break;
+    }
+    if(nv == &p->space->vma[NVMA])
+      return -1;
+  }
+
+  if(v->f && (v->flags & MAP_SHARED)){
+    if(dp == 0)
+      writeback(p->pagetable, v, start, end);
+    else if(keepdirty(p->pagetable, v, start, end, dp) != 0)
+      return -1;
+  }
+  if(uvmunmap(p->pagetable, start, (end - start) / PGSIZE, 1) != 0)
+    return -1;
+
+  if(nv){
+    *nv = *v;
+    nv->addr = end;
+    nv->len = v->addr + v->len - end;
+    nv->off = v->off + (end - v->addr);
+    filedup(nv->f);
+    v->len = start - v->addr;
+  } else if(start == v->addr && end == v->addr + v->len){
+    if(v->f)
+      fileclose(v->f);
+    memset(v, 0, sizeof(*v));
+  } else if(start == v->addr){
+    v->off += end - start;
+    v->addr = end;
+    v->len -= end - start;
+  } else {
+    v->len = start - v->addr;
+  }
+  return 0;
+}
+
+// mmap() for p, with the space's vmlock held.
+static uint64
+vmamap(struct proc *p, uint64 addr, uint64 len, int prot, int flags,
+       struct file *f, uint64 off)
+{
+  struct vma *v, *o;
+
+  if(len == 0 || len > MAXUVA)
+    return -1;
+  len = PGROUNDUP(len);
+  if((flags & (MAP_SHARED|MAP_PRIVATE)) == 0 ||
+     (flags & (MAP_SHARED|MAP_PRIVATE)) == (MAP_SHARED|MAP_PRIVATE))
+    return -1;
+  if(f){
+    if(f->type != FD_INODE || !f->readable || off % PGSIZE != 0)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  }
+
+  for(v = p->space->vma; v < &p->space->vma[NVMA]; v++){
+    if(v->len == 0)
+      break;
+  }
+  if(v == &p->space->vma[NVMA])
+    return -1;
+
+  // use the hint if it's free, else search down from MAXUVA.
+  if(addr % PGSIZE != 0 || addr < PGROUNDUP(p->space->sz) ||
+     addr + len > MAXUVA || overlap(p, addr, len)){
+    addr = MAXUVA - len;
+    while((o = overlap(p, addr, len)) != 0){
+      if(o->addr < len)
+        return -1;
+      addr = o->addr - len;
+    }
+    if(addr < PGROUNDUP(p->space->sz))
+      return -1;
+  }
+
+  v->addr = addr;
+  v->len = len;
+  v->prot = prot;
+  v->flags = flags & (MAP_SHARED|MAP_PRIVATE);
+  v->f = f ? filedup(f) : 0;
+  v->off = off;
+  return addr;
+}
+
+// Map len bytes of f at offset off (or anonymous memory,
+// if f is 0) into the current process, at addr if that
+// range is free, otherwise wherever there's room.
+// Returns the address, or -1.
+uint64
+mmap(uint64 addr, uint64 len, int prot, int flags, struct file *f, uint64 off)
+{
+  struct proc *p = myproc();
+  uint64 r;
+
+  acquiresleep(&p->space->vmlock);
+  r = vmamap(p, addr, len, prot, flags, f, off);
+  releasesleep(&p->space->vmlock);
+  return r;
+}
+
+// Unmap [addr, addr+len) from the current process.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc();
+  struct dirtypages *dp = 0, *d;
+  struct vma *v;
+  uint64 start, end;
+  int i, r = 0;
+
+  if(addr % PGSIZE != 0 || len == 0 || addr + len < addr)
+    return -1;
+  len = PGROUNDUP(len);
+  acquiresleep(&p->space->vmlock);
+  for(v = p->space->vma; v < &p->space->vma[NVMA]; v++){
+    if(v->len == 0 || addr >= v->addr + v->len || v->addr >= addr + len)
+      continue;
+    start = addr > v->addr ? addr : v->addr;
+    end = addr + len < v->addr + v->len ? addr + len : v->addr + v->len;
+    if((r = vmaunmap(p, v, start, end, &dp)) < 0)
+      break;
+  }
+  releasesleep(&p->space->vmlock);
+
+  // write back only now: another thread may hold the file's
+  // inode lock, or be in a transaction, while its copy waits
+  // in vmfault() for the vmlock.
+  while((d = dp) != 0){
+    for(i = 0; i < d->n; i++){
+      writepage(d->pg[i].f->ip, d->pg[i].pa, d->pg[i].off);
+      kfree((void*)d->pg[i].pa);
+      fileclose(d->pg[i].f);
+    }
+    dp = d->next;
+    kfree(d);
+  }
+  return r;
+}
+
+// Handle a page fault at va, above the heap.
+// returns 0 if the fault was fixed, -1 if va isn't in a
+// region, the access isn't allowed, or out of memory.
+int
+vmafault(struct proc *p, uint64 va, int write)
+{
+  struct vma *v;
+  struct inode *ip;
+  pte_t *pte;
+  char *mem;
+  uint64 off;
+  uint n;
+  int perm;
+
+  if((v = findvma(p, va)) == 0)
+    return -1;
+  if(write && (v->prot & PROT_WRITE) == 0)
+    return -1;
+  if(v->prot == PROT_NONE)
+    return -1;
+  va = PGROUNDDOWN(va);
+  perm = prot2perm(v->prot) | PTE_U;
+
+  pte = walk(p->pagetable, va, 0);
+  if(pte && (*pte & PTE_V)){
+    if(!write)
+      return -1;
+    if(*pte & PTE_COW)
+      return uvmcow(p->pagetable, va);
+    if(v->flags & MAP_SHARED){
+      // first write to a clean shared page.
+      *pte |= PTE_W | PTE_D;
+      return 0;
+    }
+    return -1;
+  }
+
+  if(v->f == 0){
+    if((mem = kalloc_zeroed()) == 0)
+      return -1;
+  } else {
+    // reading the file may sleep; see vmprefault().
+    if(!intr_get())
+      return -1;
+    ip = v->f->ip;
+    off = v->off + (va - v->addr);
+    ilock(ip);
+    n = 0;
+    if(off < ip->size)
+      n = ip->size - off;
+    if(n > PGSIZE)
+      n = PGSIZE;
+    if(n == 0){
+      mem = kalloc_zeroed();
+    } else if(v->flags & MAP_PRIVATE){
+      if((mem = pcacheread(ip, off, n)) != 0 && (perm & PTE_W))
+        perm = (perm & ~PTE_W) | PTE_COW;
+    } else {
+      if((mem = kalloc()) != 0){
+        if(readi(ip, 0, (uint64)mem, off, n) != n){
+          kfree(mem);
+          mem = 0;
+        } else {
+          memset(mem + n, 0, PGSIZE - n);
+        }
+      }
+    }
+    iunlock(ip);
+    if(mem == 0)
+      return -1;
+    if(v->flags & MAP_SHARED){
+      perm &= ~PTE_W;
+      if(write)
+        perm |= PTE_W | PTE_D;
+    }
+  }
+
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Give child np copies of p's regions, for fork().
+// returns 0 on success, -1 on failure, leaving np
+// with no regions.
+int
+vmacopy(struct proc *p, struct proc *np)
+{
+  struct vma *v, *nv;
+
+  for(v = p->space->vma, nv = np->space->vma; v < &p->space->vma[NVMA]; v++, nv++){
+    if(v->len == 0)
+      continue;
+    if(uvmcopyrange(p->pagetable, np->pagetable, v->addr, v->len,
+                    (v->flags & MAP_SHARED) != 0) < 0)
+      goto err;
+    *nv = *v;
+    if(nv->f)
+      filedup(nv->f);
+  }
+  return 0;
+
+ err:
+  for(nv = np->space->vma; nv < &np->space->vma[NVMA]; nv++){
+    if(nv->len){
+      uvmunmap(np->pagetable, nv->addr, nv->len / PGSIZE, 1);
+      if(nv->f)
+        fileclose(nv->f);
+      memset(nv, 0, sizeof(*nv));
+    }
+  }
+  return -1;
+}
+
+// Unmap all of p's regions, for exit() and exec().
+void
+vmafree(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->space->vma; v < &p->space->vma[NVMA]; v++){
+    if(v->len)
+      vmaunmap(p, v, v->addr, v->addr + v->len, 0);
+  }
+}
@@ -1,6 +1,10 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC      4096  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
+#define NTHREAD      64  // maximum threads per process
+#define NPRIO         3  // scheduling priority levels
 #define NOFILE       16  // open files per process
+#define NSEG          4  // loadable ELF segments per executable
+#define NVMA         16  // mmap() regions per process
 #define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
@@ -8,6 +12,15 @@
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define NBUF         (MAXOPBLOCKS*3)  // buffers the disk block cache starts with
+#ifndef BCACHEMAX
+#define BCACHEMAX    4096  // most buffers the disk block cache may grow to
+#endif
+#define NBUCKET      13  // hash buckets in the disk block cache
+#define RAMIN         4  // first readahead window of a file, in blocks
+#define RAMAX        32  // largest readahead window, in blocks
+#define NPCACHE      256  // pages in the executable page cache
+#define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define MAXORDER     10    // largest kalloc_order() block is 2^MAXORDER pages
+#define TICKCYCLES   1000000  // time CSR cycles per tick; about 1/10th second in qemu
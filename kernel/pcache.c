@@ -0,0 +1,220 @@
+// Page cache for executables and private file mappings.
+//
+// Holds the pages that vmfault() reads in from programs (and
+// from files mapped with MAP_PRIVATE), so that processes
+// running the same binary share one physical copy of each
+// page instead of each reading its own. A page
+// is identified by the file range it was read from: n bytes
+// (n <= PGSIZE) starting at offset off of inode (dev, inum),
+// followed by zeroes to the end of the page.
+//
+// The cache holds one reference (see kdup()) to each of its
+// pages, and every process that maps one holds another.
+// Processes map cached pages without PTE_W (copy-on-write if
+// the segment or mapping is writable), so cached pages never
+// change.
+//
+// Interface:
+// * pcacheget() looks up a page and returns it with a new reference.
+// * pcacheput() adds a page that the caller has just read in.
+// * pcacheread() does both: looks a page up, reading it in on a miss.
+// * pcacheinval() drops an inode's pages when the file changes;
+//     processes that already map them keep the old contents.
+// * pcachereclaim() gives back pages that only the cache uses,
+//     for when kalloc() runs out of memory.
+//
+// pcacheput() and pcacheinval() must be called with the inode
+// locked, so that a page read before a write to the file can't
+// be added after the write has invalidated the cache.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+
+#define NPCBUCKET 31
+
+struct pcpage {
+  uint dev;
+  uint inum;
+  uint off;              // file offset of the page's first byte
+  uint n;                // bytes read from the file
+  char *pa;              // the page, or 0 if this entry is unused
+  uint lastuse;          // pcache.clock at the last lookup
+  struct pcpage *next;   // hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct pcpage page[NPCACHE];
+  struct pcpage *bucket[NPCBUCKET];  // chains, hashed by (dev, inum)
+  uint clock;                        // counts lookups, for LRU
+  int n;                             // entries in use
+} pcache;
+
+static struct pcpage**
+pchash(uint dev, uint inum)
+{
+  return &pcache.bucket[(dev * 131 + inum) % NPCBUCKET];
+}
+
+// Remove e from its hash chain and give up the cache's
+// reference to its page. Caller must hold pcache.lock.
+static void
+pcdrop(struct pcpage *e)
+{
+  struct pcpage **pp;
+
+  for(pp = pchash(e->dev, e->inum); *pp != e; pp = &(*pp)->next)
+    ;
+  *pp = e->next;
+  kfree(e->pa);
+  e->pa = 0;
+  pcache.n--;
+}
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+// Return the cached copy of n bytes at offset off of ip,
+// with a reference for the caller, or 0 if there is none.
+char*
+pcacheget(struct inode *ip, uint off, uint n)
+{
+  struct pcpage *e;
+  char *pa = 0;
+
+  acquire(&pcache.lock);
+  for(e = *pchash(ip->dev, ip->inum); e; e = e->next){
+    if(e->dev == ip->dev && e->inum == ip->inum && e->off == off && e->n == n){
+      e->lastuse = ++pcache.clock;
+      pa = e->pa;
+      kdup(pa);
+      break;
+    }
+  }
+  release(&pcache.lock);
+  return pa;
+}
+
+// Add pa, holding n bytes at offset off of ip, to the
+// cache. The cache takes its own reference to the page.
+// If the cache is full, evicts the least recently used page.
+// Caller must hold ip's lock.
+void
+pcacheput(struct inode *ip, uint off, uint n, char *pa)
+{
+  struct pcpage *e, *victim;
+  struct pcpage **pp;
+
+  if(!holdingsleep(&ip->lock))
+    panic("pcacheput");
+
+  acquire(&pcache.lock);
+  pp = pchash(ip->dev, ip->inum);
+  for(e = *pp; e; e = e->next){
+    if(e->dev == ip->dev && e->inum == ip->inum && e->off == off && e->n == n){
+      // another process read the same page in first.
+      release(&pcache.lock);
+      return;
+    }
+  }
+
+  victim = 0;
+  for(e = pcache.page; e < &pcache.page[NPCACHE]; e++){
+    if(e->pa == 0){
+      victim = e;
+      break;
+    }
+    if(victim == 0 || e->lastuse < victim->lastuse)
+      victim = e;
+  }
+  if(victim->pa)
+    pcdrop(victim);
+
+  kdup(pa);
+  victim->dev = ip->dev;
+  victim->inum = ip->inum;
+  victim->off = off;
+  victim->n = n;
+  victim->pa = pa;
+  victim->lastuse = ++pcache.clock;
+  victim->next = *pp;
+  *pp = victim;
+  pcache.n++;
+  release(&pcache.lock);
+}
+
+// Return a page holding n bytes at offset off of ip followed
+// by zeroes, with a reference for the caller: the cached copy,
+// or a new one read from the file and added to the cache.
+// Returns 0 if out of memory or the file is too short.
+// Caller must hold ip's lock.
+char*
+pcacheread(struct inode *ip, uint off, uint n)
+{
+  char *mem;
+
+  if((mem = pcacheget(ip, off, n)) != 0)
+    return mem;
+  if((mem = kalloc()) == 0)
+    return 0;
+  if(readi(ip, 0, (uint64)mem, off, n) != n){
+    kfree(mem);
+    return 0;
+  }
+  memset(mem + n, 0, PGSIZE - n);
+  pcacheput(ip, off, n, mem);
+  return mem;
+}
+
+// ip's contents are about to change: forget its pages.
+// Caller must hold ip's lock.
+void
+pcacheinval(struct inode *ip)
+{
+  struct pcpage *e, *next;
+
+  acquire(&pcache.lock);
+  if(pcache.n > 0){
+    for(e = *pchash(ip->dev, ip->inum); e; e = next){
+      next = e->next;
+      if(e->dev == ip->dev && e->inum == ip->inum)
+        pcdrop(e);
+    }
+  }
+  release(&pcache.lock);
+}
+
+// Give back every cached page that no process has mapped.
+// Returns the number of pages freed.
+int
+pcachereclaim(void)
+{
+  struct pcpage *e;
+  int n = 0;
+
+  acquire(&pcache.lock);
+  for(e = pcache.page; e < &pcache.page[NPCACHE]; e++){
+    if(e->pa && krefcount(e->pa) == 1){
+      pcdrop(e);
+      n++;
+    }
+  }
+  release(&pcache.lock);
+  return n;
+}
+
+// Number of pages in the cache.
+int
+pcachecount(void)
+{
+  return pcache.n;
+}
@@ -3,17 +3,33 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
+#include "space.h"
 #include "defs.h"
+#include "schedstat.h"
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
+// proc[] starts out empty. allocproc() fills it in on demand,
+// a page of procs at a time, each with its own kernel stack,
+// so only as many exist as have been needed at once. Slots
+// are never freed; an UNUSED proc goes on freeprocs for reuse.
+struct proc *proc[NPROC];
+int nproc;                 // entries of proc[] filled in
 
 struct proc *initproc;
 
+// pid_lock protects nextpid, the list of UNUSED procs, and a
+// hash table of the others by pid, so that allocproc() and
+// findproc() need not scan proc[]. It comes after p->lock.
+#define NPIDHASH 64
+
 int nextpid = 1;
 struct spinlock pid_lock;
+struct proc *freeprocs;            // UNUSED procs, by p->pidnext
+struct proc *procslot;             // next unfilled proc in the last page of procs
+struct proc *pidhash[NPIDHASH];    // the rest, by p->pidnext
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
@@ -26,34 +42,293 @@ extern char trampoline[]; // trampoline.S
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
-// Allocate a page for each process's kernel stack.
-// Map it high in memory, followed by an invalid
-// guard page.
-void
-proc_mapstacks(pagetable_t kpgtbl) {
+// Each CPU has a queue of RUNNABLE processes, in cpus[i].runq.
+// A process that becomes RUNNABLE joins the queue of the CPU it
+// last ran on, whose caches may still hold its memory; a new
+// process joins its parent's. scheduler() runs the processes on
+// its own CPU's queue in order, and when that is empty, steals
+// the first process from the longest queue of another CPU.
+// A process runs only on the CPUs in p->affinity (see
+// setaffinity()): it joins the queue of one of those if its
+// last CPU isn't, and other CPUs don't steal it.
+//
+// A process on a run queue is always RUNNABLE, and no other
+// code changes its state until scheduler() takes it off. Since
+// a process is queued with p->lock held, the queue locks are
+// taken after p->lock, never before.
+//
+// The queues are multi-level feedback queues: each CPU has a
+// queue for each of NPRIO priorities, 0 being the highest, and
+// runs the first process of the highest non-empty one. A
+// process starts at its base priority (p->baseprio, 0 unless
+// set with setpriority()). Each timer tick a process is running
+// for counts against it (see yield()), and once it has used
+// 1 << p->prio ticks at a level, it moves down one, so that
+// compute-bound processes sink below interactive ones. Every
+// BOOSTTICKS ticks all processes go back to their base
+// priority, so that none starves; boosts are applied lazily,
+// when a process is next queued or a CPU next picks from its
+// queues.
+#define BOOSTTICKS 30
+
+uint64 nipi;          // IPIs sent by kick()
+int nbusy;            // CPUs in scheduler() that are not idle
+
+// Send an IPI to c if it is idle in wfi. only the first
+// caller after c went idle sends one.
+static void
+kick(struct cpu *c)
+{
+  if(__sync_lock_test_and_set(&c->idle, 0)){
+    __sync_fetch_and_add(&nipi, 1);
+    ipi(c - cpus);
+  }
+}
+
+// Make p RUNNABLE and add it to the end of a run queue.
+// Caller must hold p->lock.
+static void
+ready(struct proc *p)
+{
+  struct cpu *c = &cpus[p->cpu];
+  uint epoch = ticks / BOOSTTICKS;
+
+  if((p->affinity & (1L << p->cpu)) == 0){
+    for(c = cpus; c < &cpus[NCPU]; c++){
+      if(c->started && (p->affinity & (1L << (c - cpus))))
+        break;
+    }
+    if(c == &cpus[NCPU])
+      c = &cpus[p->cpu];
+  }
+
+  if(p->epoch != epoch){
+    p->prio = p->baseprio;
+    p->used = 0;
+    p->epoch = epoch;
+  }
+  p->state = RUNNABLE;
+  acquire(&c->rqlock);
+  p->rqnext = 0;
+  if(c->runqtail[p->prio])
+    c->runqtail[p->prio]->rqnext = p;
+  else
+    c->runq[p->prio] = p;
+  c->runqtail[p->prio] = p;
+  c->nrunq++;
+  release(&c->rqlock);
+
+  // wake c if it is waiting in wfi, or else an idle
+  // CPU that p may run on, so that it can steal p.
+  if(!c->idle){
+    for(c = cpus; c < &cpus[NCPU]; c++){
+      if(c->idle && (p->affinity & (1L << (c - cpus))))
+        break;
+    }
+    if(c == &cpus[NCPU])
+      return;
+  }
+  kick(c);
+}
+
+// Remove p, which follows prev, from c's queue at level i.
+// Caller must hold c->rqlock.
+static void
+unlinkrq(struct cpu *c, int i, struct proc *prev, struct proc *p)
+{
+  if(prev)
+    prev->rqnext = p->rqnext;
+  else
+    c->runq[i] = p->rqnext;
+  if(c->runqtail[i] == p)
+    c->runqtail[i] = prev;
+  p->rqnext = 0;
+  c->nrunq--;
+}
+
+// Take the first process off c's highest-priority non-empty
+// queue that may run on one of the CPUs in mask, or return 0.
+static struct proc*
+dequeue(struct cpu *c, uint64 mask)
+{
+  struct proc *p = 0, *prev;
+  uint epoch = ticks / BOOSTTICKS;
+  int i;
+
+  if(c->nrunq == 0)
+    return 0;
+  acquire(&c->rqlock);
+  if(c->epoch != epoch){
+    // boost: move everything to the end of the top queue.
+    for(i = 1; i < NPRIO; i++){
+      if(c->runq[i] == 0)
+        continue;
+      if(c->runqtail[0])
+        c->runqtail[0]->rqnext = c->runq[i];
+      else
+        c->runq[0] = c->runq[i];
+      c->runqtail[0] = c->runqtail[i];
+      c->runq[i] = c->runqtail[i] = 0;
+    }
+    c->epoch = epoch;
+  }
+  for(i = 0; i < NPRIO; i++){
+    prev = 0;
+    for(p = c->runq[i]; p; prev = p, p = p->rqnext){
+      // p->affinity may change under us; scheduler()
+      // checks it again with p->lock held.
+      if(p->affinity & mask)
+        break;
+    }
+    if(p){
+      unlinkrq(c, i, prev, p);
+      break;
+    }
+  }
+  release(&c->rqlock);
+  return p;
+}
+
+// Take p off whichever run queue it is on, so that it can be
+// queued again at another priority. Caller must hold p->lock.
+// returns 0 if p isn't on a queue, because a scheduler()
+// has just taken it off to run it.
+static int
+unqueue(struct proc *p)
+{
+  struct proc *q, *prev;
+  struct cpu *c;
+  int i;
+
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    acquire(&c->rqlock);
+    // a boost may have moved p to another level
+    // than p->prio, so look at them all.
+    for(i = 0; i < NPRIO; i++){
+      prev = 0;
+      for(q = c->runq[i]; q; prev = q, q = q->rqnext){
+        if(q == p){
+          unlinkrq(c, i, prev, p);
+          release(&c->rqlock);
+          return 1;
+        }
+      }
+    }
+    release(&c->rqlock);
+  }
+  return 0;
+}
+
+// Take a process from the longest run queue of another CPU,
+// for an idle CPU c. Returns 0 if there's nothing to take.
+static struct proc*
+steal(struct cpu *c)
+{
+  struct cpu *o, *busiest;
   struct proc *p;
-  
-  for(p = proc; p < &proc[NPROC]; p++) {
-    char *pa = kalloc();
-    if(pa == 0)
-      panic("kalloc");
-    uint64 va = KSTACK((int) (p - proc));
-    kvmmap(kpgtbl, va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
+  uint64 tried = 1L << (c - cpus);
+
+  for(;;){
+    busiest = 0;
+    for(o = cpus; o < &cpus[NCPU]; o++){
+      if((tried & (1L << (o - cpus))) == 0 && o->nrunq > 0 &&
+         (busiest == 0 || o->nrunq > busiest->nrunq))
+        busiest = o;
+    }
+    if(busiest == 0)
+      return 0;
+    // nrunq was read without the lock, so the queue may
+    // have emptied since, or hold only processes that
+    // may not run on c.
+    if((p = dequeue(busiest, 1L << (c - cpus))) != 0)
+      return p;
+    tried |= 1L << (busiest - cpus);
+  }
+}
+
+// Sleeping processes are kept in a hash table keyed by their
+// wait channel, so that wakeup() need only look at processes
+// sleeping on channels with the same hash. A process adds
+// itself to sleepq[] in sleep() and removes itself when it
+// wakes up. The sleepq locks are taken before p->lock.
+#define NSLEEPQ 61
+
+struct {
+  struct spinlock lock;
+  struct proc *head;  // processes sleeping on chans that hash here
+} sleepq[NSLEEPQ];
+
+// counts for schedstat().
+uint64 nwakeup;       // calls to wakeup()
+uint64 nwakeupscan;   // processes wakeup() looked at
+uint64 nwoken;        // processes wakeup() made RUNNABLE
+
+static int
+sleephash(void *chan)
+{
+  return ((uint64)chan >> 3) % NSLEEPQ;
+}
+
+// the kernel stacks, with their guard pages, must lie between
+// the direct-mapped RAM and the lowest thread's trapframe.
+_Static_assert(KSTACK(0) + PGSIZE < TRAPFRAMEN(NTHREAD-1),
+               "kernel stacks overlap the trapframes");
+_Static_assert(KSTACK(NPROC-1) - PGSIZE >= PHYSTOP,
+               "kernel stacks overlap RAM");
+
+// Add a page's worth of procs to proc[] and the free list.
+// Each gets a page for its kernel stack, mapped high in
+// memory at KSTACK() of its index, below an invalid guard page.
+// If that runs out of memory partway through the page, the
+// rest of the page is filled in next time, before another.
+// Caller must hold pid_lock. returns -1 if out of memory
+// or proc[] is full.
+static int
+growprocs(void)
+{
+  struct proc *p;
+  char *page, *kstack;
+  int n = 0;
+
+  if(nproc == NPROC)
+    return -1;
+  if(procslot == 0 && (procslot = kalloc_zeroed()) == 0)
+    return -1;
+  page = (char*)PGROUNDDOWN((uint64)procslot);
+  for(p = procslot; (char*)(p+1) <= page + PGSIZE; p++){
+    if(nproc == NPROC || (kstack = kalloc()) == 0)
+      break;
+    p->kstack = KSTACK(nproc);
+    if(kvmmapstack(p->kstack, (uint64)kstack) < 0){
+      kfree(kstack);
+      break;
+    }
+    initlock(&p->lock, "proc");
+    p->pidnext = freeprocs;
+    freeprocs = p;
+    // wait() and friends read proc[i] for i < nproc
+    // without pid_lock.
+    proc[nproc] = p;
+    __sync_synchronize();
+    nproc++;
+    n++;
   }
+  procslot = (char*)(p+1) <= page + PGSIZE ? p : 0;
+  return n > 0 ? 0 : -1;
 }
 
 // initialize the proc table at boot time.
 void
 procinit(void)
 {
-  struct proc *p;
+  struct cpu *c;
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
-  for(p = proc; p < &proc[NPROC]; p++) {
-      initlock(&p->lock, "proc");
-      p->kstack = KSTACK((int) (p - proc));
-  }
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    initlock(&c->rqlock, "runq");
+  for(int i = 0; i < NSLEEPQ; i++)
+    initlock(&sleepq[i].lock, "sleepq");
 }
 
 // Must be called with interrupts disabled,
@@ -85,40 +360,142 @@ myproc(void) {
   return p;
 }
 
-int
-allocpid() {
-  int pid;
-  
+// Give p, which was UNUSED, a new pid.
+// Caller must hold p->lock.
+static void
+allocpid(struct proc *p) {
+  int h;
+
   acquire(&pid_lock);
-  pid = nextpid;
+  p->pid = nextpid;
   nextpid = nextpid + 1;
+  h = p->pid % NPIDHASH;
+  p->pidnext = pidhash[h];
+  pidhash[h] = p;
   release(&pid_lock);
+}
 
-  return pid;
+// Take p out of the pid hash table and put it back on
+// the free list. Caller must hold p->lock.
+static void
+freepid(struct proc *p) {
+  struct proc **pp;
+
+  acquire(&pid_lock);
+  for(pp = &pidhash[p->pid % NPIDHASH]; *pp; pp = &(*pp)->pidnext){
+    if(*pp == p){
+      *pp = p->pidnext;
+      break;
+    }
+  }
+  p->pid = 0;
+  p->pidnext = freeprocs;
+  freeprocs = p;
+  release(&pid_lock);
 }
 
-// Look in the process table for an UNUSED proc.
-// If found, initialize state required to run in the kernel,
-// and return with p->lock held.
-// If there are no free procs, or a memory allocation fails, return 0.
+// Return the process with the given pid, with p->lock
+// held, or 0 if there is none.
 static struct proc*
-allocproc(void)
+findproc(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
-    }
+  if(pid <= 0)
+    return 0;
+  acquire(&pid_lock);
+  for(p = pidhash[pid % NPIDHASH]; p; p = p->pidnext){
+    if(p->pid == pid)
+      break;
+  }
+  release(&pid_lock);
+  if(p == 0)
+    return 0;
+  // p may have been freed, even reused, in the meantime.
+  acquire(&p->lock);
+  if(p->pid != pid || p->state == UNUSED){
+    release(&p->lock);
+    return 0;
   }
+  return p;
+}
+
+// Give new thread p a trapframe slot in t's space, and map
+// its trapframe there. returns -1 if the space has no free
+// slot or there is no memory for the mapping.
+static int
+attachspace(struct proc *p, struct proc *t)
+{
+  struct space *s = t->space;
+  int i;
+
+  acquire(&s->lock);
+  for(i = 0; i < NTHREAD; i++){
+    if((s->threads & (1L << i)) == 0)
+      break;
+  }
+  if(i == NTHREAD || mappages(t->pagetable, TRAPFRAMEN(i), PGSIZE,
+                              (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
+    release(&s->lock);
+    return -1;
+  }
+  s->threads |= 1L << i;
+  s->ref++;
+  release(&s->lock);
+  p->space = s;
+  p->pagetable = t->pagetable;
+  p->tfva = TRAPFRAMEN(i);
   return 0;
+}
+
+// Detach p from a space that other threads still use, and
+// unmap p's trapframe from their page table. returns -1,
+// leaving p attached, if p is the space's only thread.
+static int
+detachspace(struct proc *p)
+{
+  struct space *s = p->space;
 
-found:
-  p->pid = allocpid();
+  acquire(&s->lock);
+  if(s->ref == 1){
+    release(&s->lock);
+    return -1;
+  }
+  s->ref--;
+  s->threads &= ~(1L << ((TRAPFRAME - p->tfva) / PGSIZE));
+  uvmunmap(p->pagetable, p->tfva, 1, 0);
+  release(&s->lock);
+  p->space = 0;
+  p->pagetable = 0;
+  return 0;
+}
+
+// Take an UNUSED proc off the free list, growing proc[] if need be.
+// If there is one, initialize state required to run in the kernel,
+// and return with p->lock held. If t is not 0, the new proc is a
+// thread sharing t's memory and files; otherwise it gets its own.
+// If there are no free procs, or a memory allocation fails, return 0.
+static struct proc*
+allocproc(struct proc *t)
+{
+  struct proc *p;
+  struct space *s;
+
+  acquire(&pid_lock);
+  if(freeprocs == 0)
+    growprocs();
+  if((p = freeprocs) != 0)
+    freeprocs = p->pidnext;
+  release(&pid_lock);
+  if(p == 0)
+    return 0;
+
+  acquire(&p->lock);
+  if(p->state != UNUSED)
+    panic("allocproc");
+  allocpid(p);
   p->state = USED;
+  p->affinity = (1L << NCPU) - 1;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -127,9 +504,36 @@ found:
     return 0;
   }
 
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
-  if(p->pagetable == 0){
+  if(t){
+    if(attachspace(p, t) < 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
+  } else {
+    // A space of its own, with an empty user page table
+    // and the trapframe in the first slot.
+    if((s = (struct space *)kalloc_zeroed()) == 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
+    initlock(&s->lock, "space");
+    initsleeplock(&s->vmlock, "vm");
+    s->ref = 1;
+    s->threads = 1;
+    p->space = s;
+    p->tfva = TRAPFRAMEN(0);
+    p->pagetable = proc_pagetable(p);
+    if(p->pagetable == 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
+  }
+
+  // A kernel page table that also maps the user memory.
+  if((p->kpagetable = kvmcreate(p->pagetable)) == 0){
     freeproc(p);
     release(&p->lock);
     return 0;
@@ -145,7 +549,7 @@ found:
 }
 
 // free a proc structure and the data hanging from it,
-// including user pages.
+// including user pages if it was the last thread using them.
 // p->lock must be held.
 static void
 freeproc(struct proc *p)
@@ -153,11 +557,25 @@ freeproc(struct proc *p)
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
-  if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
+  if(p->kpagetable)
+    kvmfree(p->kpagetable);
+  p->kpagetable = 0;
+  if(p->space && detachspace(p) < 0){
+    if(p->pagetable)
+      proc_freepagetable(p->pagetable, p->tfva, p->space->sz);
+    kfree((void*)p->space);
+  }
+  p->space = 0;
   p->pagetable = 0;
-  p->sz = 0;
-  p->pid = 0;
+  p->tfva = 0;
+  p->ustack = 0;
+  p->thread = 0;
+  p->nfault = 0;
+  p->prio = 0;
+  p->baseprio = 0;
+  p->used = 0;
+  p->nmigrate = 0;
+  freepid(p);
   p->parent = 0;
   p->name[0] = 0;
   p->chan = 0;
@@ -188,8 +606,8 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
-  // map the trapframe just below TRAMPOLINE, for trampoline.S.
-  if(mappages(pagetable, TRAPFRAME, PGSIZE,
+  // map the trapframe below TRAMPOLINE, in p's slot, for trampoline.S.
+  if(mappages(pagetable, p->tfva, PGSIZE,
               (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
     uvmunmap(pagetable, TRAMPOLINE, 1, 0);
     uvmfree(pagetable, 0);
@@ -199,13 +617,13 @@ proc_pagetable(struct proc *p)
   return pagetable;
 }
 
-// Free a process's page table, and free the
-// physical memory it refers to.
+// Free a process's page table, with its last thread's trapframe
+// mapped at tfva, and free the physical memory it refers to.
 void
-proc_freepagetable(pagetable_t pagetable, uint64 sz)
+proc_freepagetable(pagetable_t pagetable, uint64 tfva, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
-  uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, tfva, 1, 0);
   uvmfree(pagetable, sz);
 }
 
@@ -227,13 +645,13 @@ userinit(void)
 {
   struct proc *p;
 
-  p = allocproc();
+  p = allocproc(0);
   initproc = p;
   
   // allocate one user page and copy init's instructions
   // and data into it.
   uvminit(p->pagetable, initcode, sizeof(initcode));
-  p->sz = PGSIZE;
+  p->space->sz = PGSIZE;
 
   // prepare for the very first "return" from kernel to user.
   p->trapframe->epc = 0;      // user program counter
@@ -242,29 +660,40 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  p->cpu = cpuid();
+  ready(p);
 
   release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
-// Return 0 on success, -1 on failure.
-int
+// Return the old size, or -1 on failure.
+uint64
 growproc(int n)
 {
-  uint sz;
+  uint64 sz, oldsz;
   struct proc *p = myproc();
+  struct space *s = p->space;
 
-  sz = p->sz;
+  acquiresleep(&s->vmlock);
+  oldsz = sz = s->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
+    // allocate nothing now; vmfault() maps zeroed
+    // pages as the process touches them.
+    if(sz + n > vmabottom(p)){
+      releasesleep(&s->vmlock);
       return -1;
     }
+    sz += n;
   } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    if((sz = uvmdealloc(p->pagetable, sz, sz + n)) == oldsz){
+      releasesleep(&s->vmlock);
+      return -1;
+    }
   }
-  p->sz = sz;
-  return 0;
+  s->sz = sz;
+  releasesleep(&s->vmlock);
+  return oldsz;
 }
 
 // Create a new process, copying the parent.
@@ -275,19 +704,30 @@ fork(void)
   int i, pid;
   struct proc *np;
   struct proc *p = myproc();
+  struct space *s = p->space;
 
   // Allocate process.
-  if((np = allocproc()) == 0){
+  if((np = allocproc(0)) == 0){
     return -1;
   }
+  // np is USED, so no scheduler will run it. Let go of its
+  // lock: copying may sleep for the vmlock, and flushing
+  // the parent's TLB entries waits for other CPUs.
+  release(&np->lock);
 
-  // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
-    freeproc(np);
-    release(&np->lock);
-    return -1;
-  }
-  np->sz = p->sz;
+  // Copy user memory from parent to child, with the
+  // parent's other threads kept from changing it.
+  acquiresleep(&s->vmlock);
+  if(uvmcopy(p->pagetable, np->pagetable, s->sz) < 0)
+    goto bad;
+  np->space->sz = s->sz;
+  if(vmacopy(p, np) < 0)
+    goto bad;
+  if(s->exe)
+    np->space->exe = idup(s->exe);
+  memmove(np->space->seg, s->seg, sizeof(s->seg));
+  np->space->nseg = s->nseg;
+  releasesleep(&s->vmlock);
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -296,9 +736,62 @@ fork(void)
   np->trapframe->a0 = 0;
 
   // increment reference counts on open file descriptors.
+  acquire(&s->lock);
   for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
+    if(s->ofile[i])
+      np->space->ofile[i] = filedup(s->ofile[i]);
+  release(&s->lock);
+  np->cwd = idup(p->cwd);
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  pid = np->pid;
+
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->cpu = cpuid();
+  np->prio = np->baseprio = p->baseprio;
+  np->affinity = p->affinity;
+  ready(np);
+  release(&np->lock);
+
+  return pid;
+
+ bad:
+  releasesleep(&s->vmlock);
+  acquire(&np->lock);
+  freeproc(np);
+  release(&np->lock);
+  return -1;
+}
+
+// Create a thread of the current process, sharing its memory
+// and open files, that starts by calling fn(arg) with the
+// stack pointer at stack. fn must not return; it ends the
+// thread by calling exit(). Returns the new thread's pid.
+int
+clone(uint64 fn, uint64 stack, uint64 arg)
+{
+  int pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if(fn >= MAXUVA || stack >= MAXUVA || stack % 16 != 0)
+    return -1;
+
+  if((np = allocproc(p)) == 0)
+    return -1;
+
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->sp = stack;
+  np->trapframe->a0 = arg;
+  // a return from fn faults, which kills the thread.
+  np->trapframe->ra = -1;
+  np->ustack = stack;
   np->cwd = idup(p->cwd);
 
   safestrcpy(np->name, p->name, sizeof(p->name));
@@ -309,10 +802,14 @@ fork(void)
 
   acquire(&wait_lock);
   np->parent = p;
+  np->thread = 1;
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  np->cpu = cpuid();
+  np->prio = np->baseprio = p->baseprio;
+  np->affinity = p->affinity;
+  ready(np);
   release(&np->lock);
 
   return pid;
@@ -324,46 +821,113 @@ void
 reparent(struct proc *p)
 {
   struct proc *pp;
+  int i, n = nproc;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
+  for(i = 0; i < n; i++){
+    pp = proc[i];
     if(pp->parent == p){
+      // init wait()s for threads too.
       pp->parent = initproc;
+      pp->thread = 0;
       wakeup(initproc);
     }
   }
 }
 
-// Exit the current process.  Does not return.
-// An exited process remains in the zombie state
-// until its parent calls wait().
+// Kill the threads other than p that share p's space, and
+// wait until they have all left it.
+static void
+endthreads(struct proc *p)
+{
+  struct space *s = p->space;
+  struct proc *q;
+  int i, n;
+
+  acquire(&s->lock);
+  while(s->ref > 1){
+    release(&s->lock);
+    // a thread that hasn't seen it's been killed may clone()
+    // another, so look again each time one leaves.
+    n = nproc;
+    for(i = 0; i < n; i++){
+      q = proc[i];
+      if(q == p || q->space != s)
+        continue;
+      acquire(&q->lock);
+      if(q->space == s){
+        q->killed = 1;
+        if(q->state == SLEEPING)
+          ready(q);
+      }
+      release(&q->lock);
+    }
+    acquire(&s->lock);
+    if(s->ref > 1)
+      sleep(s, &s->lock);
+  }
+  release(&s->lock);
+}
+
+// Exit the current thread.  Does not return.
+// An exited thread remains in the zombie state
+// until its parent calls wait() or join(). The
+// process's first thread, the one fork() made, ends
+// the whole process: it kills the others and waits
+// for them before going on. The last thread of a
+// process frees its memory and closes its files;
+// the others leave them be.
 void
 exit(int status)
 {
   struct proc *p = myproc();
+  struct space *s = p->space;
 
   if(p == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
-    }
-  }
+  // threads clone() made have the other trapframe slots.
+  if(p->tfva == TRAPFRAMEN(0))
+    endthreads(p);
 
   begin_op();
   iput(p->cwd);
   end_op();
   p->cwd = 0;
 
+  if(detachspace(p) == 0){
+    // the first thread may be waiting in endthreads().
+    wakeup(s);
+    // other threads still run on the user page table
+    // that p's kernel page table shares; see kvmswitch().
+    kvmswitch(0);
+  } else {
+    // Write back and unmap mmap() regions.
+    vmafree(p);
+
+    // Close all open files.
+    for(int fd = 0; fd < NOFILE; fd++){
+      if(s->ofile[fd]){
+        struct file *f = s->ofile[fd];
+        fileclose(f);
+        s->ofile[fd] = 0;
+      }
+    }
+
+    if(s->exe){
+      begin_op();
+      iput(s->exe);
+      end_op();
+    }
+    s->exe = 0;
+    s->nseg = 0;
+  }
+
   acquire(&wait_lock);
 
   // Give any children to init.
   reparent(p);
 
-  // Parent might be sleeping in wait().
+  // Parent might be sleeping in wait() or join().
   wakeup(p->parent);
   
   acquire(&p->lock);
@@ -378,22 +942,32 @@ exit(int status)
   panic("zombie exit");
 }
 
-// Wait for a child process to exit and return its pid.
-// Return -1 if this process has no children.
-int
-wait(uint64 addr)
+// Wait for a child to exit and return its pid: a child
+// process if thread is 0, else a thread made by clone().
+// Copies the child's exit status to addr, or for a thread,
+// the stack it was given to addr. Return -1 if there are no
+// such children.
+static int
+reap(uint64 addr, int thread)
 {
   struct proc *np;
-  int havekids, pid;
+  int havekids, pid, i, n;
   struct proc *p = myproc();
+  uint64 v;
+
+  // the copyout happens with locks held.
+  if(addr != 0)
+    vmprefault(addr, thread ? sizeof(uint64) : sizeof(int), 1);
 
   acquire(&wait_lock);
 
   for(;;){
     // Scan through table looking for exited children.
     havekids = 0;
-    for(np = proc; np < &proc[NPROC]; np++){
-      if(np->parent == p){
+    n = nproc;
+    for(i = 0; i < n; i++){
+      np = proc[i];
+      if(np->parent == p && np->thread == thread){
         // make sure the child isn't still in exit() or swtch().
         acquire(&np->lock);
 
@@ -401,8 +975,9 @@ wait(uint64 addr)
         if(np->state == ZOMBIE){
           // Found one.
           pid = np->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
-                                  sizeof(np->xstate)) < 0) {
+          v = thread ? np->ustack : np->xstate;
+          if(addr != 0 && copyout(p->pagetable, addr, (char *)&v,
+                                  thread ? sizeof(uint64) : sizeof(int)) < 0) {
             release(&np->lock);
             release(&wait_lock);
             return -1;
@@ -427,6 +1002,62 @@ wait(uint64 addr)
   }
 }
 
+// Wait for a child process to exit and return its pid.
+// Return -1 if this process has no children.
+int
+wait(uint64 addr)
+{
+  return reap(addr, 0);
+}
+
+// Wait for a thread that this thread made with clone() to
+// exit, and return its pid. Stores the thread's stack pointer
+// as given to clone() at addr, so that the caller can free
+// the stack. Return -1 if there are no such threads.
+int
+join(uint64 addr)
+{
+  return reap(addr, 1);
+}
+
+// Wait in wfi for an interrupt, on a CPU with nothing to
+// run. returns a process that was made RUNNABLE while c
+// was getting ready to wait, or 0 after an interrupt.
+static struct proc*
+idle(struct cpu *c)
+{
+  struct proc *p;
+  uint64 t0, next;
+
+  // with interrupts off, an IPI that arrives after the
+  // check below stays pending, and wfi returns at once.
+  // the interrupt is taken when the scheduler turns
+  // interrupts back on.
+  intr_off();
+  c->idle = 1;
+  __sync_synchronize();
+  // a ready() from before idle was set sent no IPI.
+  if((p = dequeue(c, ~0L)) == 0 && (p = steal(c)) == 0){
+    // skip ticks while idle. the last CPU to go idle must
+    // wake for the next sleep() timer, since no other CPU
+    // is taking ticks to run the timer wheel.
+    if(__sync_sub_and_fetch(&nbusy, 1) == 0 && (next = timernext()) != -1)
+      timerarm(next * TICKCYCLES);
+    else
+      timerarm(-1);
+    t0 = r_time();
+    wfi();
+    c->idletime += r_time() - t0;
+    __sync_fetch_and_add(&nbusy, 1);
+    tickupdate();
+    // ticks again, in case a process runs here next.
+    timerarm((r_time() / TICKCYCLES + 1) * TICKCYCLES);
+  }
+  c->idle = 0;
+  intr_on();
+  return p;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
@@ -441,26 +1072,52 @@ scheduler(void)
   struct cpu *c = mycpu();
   
   c->proc = 0;
+  c->started = 1;
+  __sync_fetch_and_add(&nbusy, 1);
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
+    if((p = dequeue(c, ~0L)) == 0 && (p = steal(c)) == 0){
+      // nothing to run; spend the time zeroing free
+      // pages for kalloc_zeroed(), or else wait.
+      if(kidlezero() > 0 || (p = idle(c)) == 0)
+        continue;
+    }
+
+    // if p just yielded on another CPU, this waits
+    // until that CPU's scheduler() is done with it.
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler: not runnable");
+    if((p->affinity & (1L << cpuid())) == 0){
+      // p's affinity changed while it was on our queue.
+      ready(p);
       release(&p->lock);
+      continue;
     }
+
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    c->proc = p;
+    // count the migration before anything else looks at
+    // or sets p->cpu.
+    if(p->cpu != cpuid())
+      p->nmigrate++;
+    p->cpu = cpuid();
+    // run on p's kernel page table, so that copyin()
+    // and copyout() can reach p's memory.
+    kvmswitch(p);
+    swtch(&c->context, &p->context);
+    // p may be freed once its lock is released.
+    kvmswitch(0);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -491,13 +1148,18 @@ sched(void)
   mycpu()->intena = intena;
 }
 
-// Give up the CPU for one scheduling round.
+// Give up the CPU for one scheduling round,
+// at the end of a timer tick that p used.
 void
 yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  if(++p->used >= (1 << p->prio) && p->prio < NPRIO-1){
+    p->prio++;
+    p->used = 0;
+  }
+  ready(p);
   sched();
   release(&p->lock);
 }
@@ -529,28 +1191,42 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct proc **pp;
+  int h = sleephash(chan);
   
-  // Must acquire p->lock in order to
-  // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Must acquire chan's sleepq lock, and p->lock,
+  // in order to change p->state and then call sched.
+  // Once we hold the sleepq lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks it too),
   // so it's okay to release lk.
 
-  acquire(&p->lock);  //DOC: sleeplock1
+  acquire(&sleepq[h].lock);  //DOC: sleeplock1
+  acquire(&p->lock);
   release(lk);
 
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->sleepnext = sleepq[h].head;
+  sleepq[h].head = p;
+  release(&sleepq[h].lock);
 
   sched();
 
-  // Tidy up.
+  release(&p->lock);
+
+  // Tidy up. until now, wakeup() may still look at p,
+  // but sees that it isn't SLEEPING.
+  acquire(&sleepq[h].lock);
+  for(pp = &sleepq[h].head; *pp != p; pp = &(*pp)->sleepnext)
+    ;
+  *pp = p->sleepnext;
+  p->sleepnext = 0;
   p->chan = 0;
+  release(&sleepq[h].lock);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
@@ -560,40 +1236,116 @@ void
 wakeup(void *chan)
 {
   struct proc *p;
+  int h = sleephash(chan);
+  int n = 0;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
+  acquire(&sleepq[h].lock);
+  for(p = sleepq[h].head; p; p = p->sleepnext){
+    n++;
+    if(p->chan == chan){
       acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
+      if(p->state == SLEEPING){
+        ready(p);
+        __sync_fetch_and_add(&nwoken, 1);
       }
       release(&p->lock);
     }
   }
+  release(&sleepq[h].lock);
+  __sync_fetch_and_add(&nwakeup, 1);
+  __sync_fetch_and_add(&nwakeupscan, n);
+}
+
+// Fill in *st for the schedstat() system call.
+void
+schedstats(struct schedstat *st)
+{
+  st->wakeups = nwakeup;
+  st->wakeupscans = nwakeupscan;
+  st->woken = nwoken;
+  st->ipis = nipi;
+  st->timerintrs = ntimerintr;
+  st->time = r_time();
+  for(int i = 0; i < NCPU; i++)
+    st->idle[i] = cpus[i].idletime;
 }
 
 // Kill the process with the given pid.
 // The victim won't exit until it tries to return
-// to user space (see usertrap() in trap.c).
+// to user space (see usertrap() in trap.c). If it is
+// a process's first thread, its exit() kills the rest.
 int
 kill(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
-    release(&p->lock);
+  if((p = findproc(pid)) == 0)
+    return -1;
+  p->killed = 1;
+  if(p->state == SLEEPING){
+    // Wake process from sleep().
+    ready(p);
   }
-  return -1;
+  release(&p->lock);
+  return 0;
+}
+
+// Let the process with the given pid run only on the CPUs
+// in mask (bit i for CPU i). Fails if none of them is running.
+// If p isn't on one of them, it moves at its next switch.
+int
+setaffinity(int pid, uint64 mask)
+{
+  struct proc *p;
+  uint64 online = 0;
+
+  for(int i = 0; i < NCPU; i++){
+    if(cpus[i].started)
+      online |= 1L << i;
+  }
+  if((mask & online) == 0)
+    return -1;
+  if((p = findproc(pid)) == 0)
+    return -1;
+  p->affinity = mask & online;
+  release(&p->lock);
+  return 0;
+}
+
+// Set the base priority of the process with the given pid,
+// and move it to that priority now: if it is waiting on a
+// run queue, requeue it at the new level.
+int
+setpriority(int pid, int prio)
+{
+  struct proc *p;
+
+  if(prio < 0 || prio >= NPRIO)
+    return -1;
+  if((p = findproc(pid)) == 0)
+    return -1;
+  p->baseprio = prio;
+  p->prio = prio;
+  p->used = 0;
+  if(p->state == RUNNABLE && unqueue(p))
+    ready(p);
+  release(&p->lock);
+  return 0;
+}
+
+// Return the current priority of the process with the
+// given pid, or -1 if there is none.
+int
+getpriority(int pid)
+{
+  struct proc *p;
+  int prio;
+
+  if((p = findproc(pid)) == 0)
+    return -1;
+  prio = p->prio;
+  release(&p->lock);
+  return prio;
 }
 
 // Copy to either a user address, or kernel address,
@@ -641,9 +1393,11 @@ procdump(void)
   };
   struct proc *p;
   char *state;
+  int i;
 
   printf("\n");
-  for(p = proc; p < &proc[NPROC]; p++){
+  for(i = 0; i < nproc; i++){
+    p = proc[i];
     if(p->state == UNUSED)
       continue;
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
@@ -24,6 +24,24 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+
+  // this CPU's cache of free pages; see kalloc.c.
+  struct spinlock kmemlock;   // protects kmemfree and nkmemfree
+  struct run *kmemfree;       // free pages cached by this CPU
+  int nkmemfree;              // number of pages on kmemfree
+
+  uint64 asidgen;             // ASID generation the TLB was last flushed for
+  int started;                // scheduler() is running on this CPU
+
+  // this CPU's run queue; see proc.c.
+  struct spinlock rqlock;     // protects the fields below
+  struct proc *runq[NPRIO];   // RUNNABLE processes at each priority, oldest first
+  struct proc *runqtail[NPRIO];
+  int nrunq;                  // number of processes on all of runq
+  uint epoch;                 // ticks/BOOSTTICKS at the last boost of runq
+
+  int idle;                   // waiting in wfi; ready() must send an IPI
+  uint64 idletime;            // time CSR cycles spent in wfi
 };
 
 extern struct cpu cpus[NCPU];
@@ -80,6 +98,28 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// A loadable segment of the running executable (exe in space.h).
+// exec() only records these; vmfault() reads each page in
+// from the file the first time the process touches it.
+struct seg {
+  uint64 va;                   // start address, page-aligned
+  uint64 filesz;               // bytes from the file; the rest is zero
+  uint64 memsz;                // size in memory
+  uint off;                    // file offset of va
+  int perm;                    // PTE_R, PTE_W and PTE_X bits
+};
+
+// A region of the address space created by mmap(), above the heap.
+// Pages are filled in by vmafault() on first touch.
+struct vma {
+  uint64 addr;                 // start, page-aligned; 0 if the slot is free
+  uint64 len;                  // length in bytes, a multiple of PGSIZE
+  int prot;                    // PROT_READ, PROT_WRITE, PROT_EXEC
+  int flags;                   // MAP_SHARED or MAP_PRIVATE
+  struct file *f;              // mapped file, or 0 if anonymous
+  uint64 off;                  // file offset of addr
+};
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -92,17 +132,31 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int cpu;                     // CPU that last ran p; its run queue p joins
+  uint64 affinity;             // CPUs p may run on, bit i for cpus[i]
+  uint64 nmigrate;             // times p has run on a different CPU than before
+  struct proc *rqnext;         // next on a run queue, under that CPU's rqlock
+  int prio;                    // scheduling priority, 0 (highest) to NPRIO-1
+  int baseprio;                // priority to start at and return to on boosts
+  int used;                    // timer ticks used at prio
+  uint epoch;                  // ticks/BOOSTTICKS when prio was last reset
+  struct proc *sleepnext;      // next in chan's sleepq, under its lock
+  struct proc *pidnext;        // next in pid hash chain or free list, under pid_lock
 
-  // wait_lock must be held when using this:
+  // wait_lock must be held when using these:
   struct proc *parent;         // Parent process
+  int thread;                  // made by clone(), for join() to reap
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
-  uint64 sz;                   // Size of process memory (bytes)
-  pagetable_t pagetable;       // User page table
+  uint64 nfault;               // Page faults handled by vmfault()
+  struct space *space;         // Memory and open files, shared by threads
+  pagetable_t pagetable;       // User page table, the same for all threads
+  pagetable_t kpagetable;      // Kernel page table, also mapping user memory
   struct trapframe *trapframe; // data page for trampoline.S
+  uint64 tfva;                 // where trapframe is in the user page table
+  uint64 ustack;               // user stack given to clone(), for join()
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
 };
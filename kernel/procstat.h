@@ -0,0 +1,9 @@
+// Statistics about the calling process, filled in by the
+// procstat() system call.
+struct procstat {
+  uint64 sz;          // size of the address space (bytes)
+  uint64 resident;    // pages below sz actually backed by memory
+  uint64 pagefaults;  // page faults handled: lazy fills and copy-on-write
+  uint64 superpages;  // 2-megabyte superpages mapped
+  uint64 migrations;  // times moved to a different CPU
+};
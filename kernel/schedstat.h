@@ -0,0 +1,11 @@
+// Scheduler statistics, filled in by the
+// schedstat() system call.
+struct schedstat {
+  uint64 wakeups;      // calls to wakeup()
+  uint64 wakeupscans;  // sleeping processes those calls looked at
+  uint64 woken;        // processes those calls made RUNNABLE
+  uint64 ipis;         // IPIs sent to wake idle CPUs
+  uint64 timerintrs;   // timer interrupts, on all CPUs
+  uint64 time;         // time CSR cycles since boot
+  uint64 idle[NCPU];   // cycles each CPU has spent idle in wfi
+};
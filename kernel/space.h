@@ -0,0 +1,23 @@
+// What the threads of a process share: its memory and its
+// open files. fork() gives the child a space of its own, and
+// clone() a thread that shares the caller's; see proc.c.
+// All of a space's threads use the same user page table,
+// each with its trapframe in a different slot of it, at
+// TRAPFRAMEN(i) for bit i of threads.
+struct space {
+  struct spinlock lock;        // protects ref, threads and ofile[]
+  int ref;                     // threads using the space
+  uint64 threads;              // trapframe slots in use
+  struct sleeplock vmlock;     // held by a thread changing the memory
+                               // below, if it isn't the only one
+
+  uint64 sz;                   // Size of process memory (bytes)
+  struct inode *exe;           // Executable backing seg[], or 0
+  struct seg seg[NSEG];        // Segments of exe not yet paged in
+  int nseg;                    // Number of entries in seg[]
+  struct vma vma[NVMA];        // mmap() regions
+  struct file *ofile[NOFILE];  // Open files
+
+  uint64 asid;                 // ASID and its generation; see kvmswitch()
+  uint64 stale;                // CPUs that must flush asid; see uvmflush()
+};
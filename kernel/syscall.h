@@ -20,3 +20,16 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_memstat 22
+#define SYS_procstat 23
+#define SYS_mmap   24
+#define SYS_munmap 25
+#define SYS_schedstat 26
+#define SYS_setpriority 27
+#define SYS_getpriority 28
+#define SYS_sched_setaffinity 29
+#define SYS_clone  30
+#define SYS_join   31
+#define SYS_futex_wait 32
+#define SYS_futex_wake 33
+#define SYS_bcachestat 34
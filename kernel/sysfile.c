@@ -13,25 +13,39 @@
 #include "proc.h"
 #include "fs.h"
 #include "sleeplock.h"
+#include "space.h"
 #include "file.h"
 #include "fcntl.h"
+#include "bcachestat.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
+// Another thread may close the descriptor meanwhile, so the caller
+// gets a reference of its own to the file, to fileclose() when done.
 static int
 argfd(int n, int *pfd, struct file **pf)
 {
   int fd;
   struct file *f;
+  struct space *s = myproc()->space;
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if(fd < 0 || fd >= NOFILE)
     return -1;
+  acquire(&s->lock);
+  if((f = s->ofile[fd]) == 0){
+    release(&s->lock);
+    return -1;
+  }
+  filedup(f);
+  release(&s->lock);
   if(pfd)
     *pfd = fd;
   if(pf)
     *pf = f;
+  else
+    fileclose(f);
   return 0;
 }
 
@@ -41,28 +55,50 @@ static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *p = myproc();
+  struct space *s = myproc()->space;
 
+  acquire(&s->lock);
   for(fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
+    if(s->ofile[fd] == 0){
+      s->ofile[fd] = f;
+      release(&s->lock);
       return fd;
     }
   }
+  release(&s->lock);
   return -1;
 }
 
+// Remove descriptor fd, if it is still for f.
+// returns -1 if another thread got there first.
+static int
+fdfree(int fd, struct file *f)
+{
+  struct space *s = myproc()->space;
+
+  acquire(&s->lock);
+  if(s->ofile[fd] != f){
+    release(&s->lock);
+    return -1;
+  }
+  s->ofile[fd] = 0;
+  release(&s->lock);
+  return 0;
+}
+
 uint64
 sys_dup(void)
 {
   struct file *f;
   int fd;
 
+  // the new descriptor takes over argfd()'s reference.
   if(argfd(0, 0, &f) < 0)
     return -1;
-  if((fd=fdalloc(f)) < 0)
+  if((fd=fdalloc(f)) < 0){
+    fileclose(f);
     return -1;
-  filedup(f);
+  }
   return fd;
 }
 
@@ -70,38 +106,48 @@ uint64
 sys_read(void)
 {
   struct file *f;
-  int n;
+  int n, r;
   uint64 p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
+  if(argfd(0, 0, &f) < 0)
     return -1;
-  return fileread(f, p, n);
+  if(argint(2, &n) < 0 || argaddr(1, &p) < 0)
+    r = -1;
+  else
+    r = fileread(f, p, n);
+  fileclose(f);
+  return r;
 }
 
 uint64
 sys_write(void)
 {
   struct file *f;
-  int n;
+  int n, r;
   uint64 p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
+  if(argfd(0, 0, &f) < 0)
     return -1;
-
-  return filewrite(f, p, n);
+  if(argint(2, &n) < 0 || argaddr(1, &p) < 0)
+    r = -1;
+  else
+    r = filewrite(f, p, n);
+  fileclose(f);
+  return r;
 }
 
 uint64
 sys_close(void)
 {
-  int fd;
+  int fd, r;
   struct file *f;
 
   if(argfd(0, &fd, &f) < 0)
     return -1;
-  myproc()->ofile[fd] = 0;
+  if((r = fdfree(fd, f)) == 0)
+    fileclose(f);
   fileclose(f);
-  return 0;
+  return r;
 }
 
 uint64
@@ -110,9 +156,16 @@ sys_fstat(void)
   struct file *f;
   uint64 st; // user pointer to struct stat
 
-  if(argfd(0, 0, &f) < 0 || argaddr(1, &st) < 0)
+  int r;
+
+  if(argfd(0, 0, &f) < 0)
     return -1;
-  return filestat(f, st);
+  if(argaddr(1, &st) < 0)
+    r = -1;
+  else
+    r = filestat(f, st);
+  fileclose(f);
+  return r;
 }
 
 // Create the path new as a link to the same inode as old.
@@ -322,9 +375,7 @@ sys_open(void)
     return -1;
   }
 
-  if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
-    if(f)
-      fileclose(f);
+  if((f = filealloc()) == 0){
     iunlockput(ip);
     end_op();
     return -1;
@@ -336,11 +387,24 @@ sys_open(void)
   } else {
     f->type = FD_INODE;
     f->off = 0;
+    f->ranext = 0;
+    f->rawin = 0;
+    f->raend = 0;
   }
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
 
+  // only now that f is set up, since another
+  // thread may use the descriptor right away.
+  if((fd = fdalloc(f)) < 0){
+    f->type = FD_NONE;
+    fileclose(f);
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+
   if((omode & O_TRUNC) && ip->type == T_FILE){
     itrunc(ip);
   }
@@ -469,18 +533,64 @@ sys_pipe(void)
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      p->ofile[fd0] = 0;
+      fdfree(fd0, rf);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
      copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
+    fdfree(fd0, rf);
+    fdfree(fd1, wf);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   return 0;
 }
+
+uint64
+sys_mmap(void)
+{
+  uint64 addr, len, off;
+  int prot, flags, fd;
+  struct file *f = 0;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argint(4, &fd) < 0 || argaddr(5, &off) < 0)
+    return -1;
+  if((flags & MAP_ANONYMOUS) == 0){
+    if(argfd(4, 0, &f) < 0)
+      return -1;
+  }
+  // mmap() takes a reference of its own.
+  addr = mmap(addr, len, prot, flags, f, off);
+  if(f)
+    fileclose(f);
+  return addr;
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0)
+    return -1;
+  return munmap(addr, len);
+}
+
+// report buffer cache statistics.
+uint64
+sys_bcachestat(void)
+{
+  uint64 addr;
+  struct bcachestat st;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  bstat(&st);
+  if(copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
@@ -5,7 +5,12 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
+#include "space.h"
+#include "memstat.h"
+#include "procstat.h"
+#include "schedstat.h"
 
 uint64
 sys_exit(void)
@@ -41,36 +46,23 @@ sys_wait(void)
 uint64
 sys_sbrk(void)
 {
-  int addr;
   int n;
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
-    return -1;
-  return addr;
+  // another thread may be calling sbrk() too, so growproc()
+  // returns the old size.
+  return growproc(n);
 }
 
 uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   if(argint(0, &n) < 0)
     return -1;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(myproc()->killed){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  return timersleep(n);
 }
 
 uint64
@@ -95,3 +87,128 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// report free physical memory and how fragmented it is.
+uint64
+sys_memstat(void)
+{
+  uint64 addr;
+  struct memstat st;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  kmemstat(&st);
+  st.pcachepages = pcachecount();
+  if(copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+uint64
+sys_procstat(void)
+{
+  uint64 addr;
+  struct procstat st;
+  struct proc *p = myproc();
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  memset(&st, 0, sizeof(st));
+  st.sz = p->space->sz;
+  st.resident = uvmresident(p->pagetable, p->space->sz);
+  st.pagefaults = p->nfault;
+  st.superpages = uvmsuperpages(p->pagetable);
+  st.migrations = p->nmigrate;
+  if(copyout(p->pagetable, addr, (char *)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
+uint64
+sys_setpriority(void)
+{
+  int pid, prio;
+
+  if(argint(0, &pid) < 0 || argint(1, &prio) < 0)
+    return -1;
+  return setpriority(pid, prio);
+}
+
+uint64
+sys_getpriority(void)
+{
+  int pid;
+
+  if(argint(0, &pid) < 0)
+    return -1;
+  return getpriority(pid);
+}
+
+uint64
+sys_sched_setaffinity(void)
+{
+  int pid;
+  uint64 mask;
+
+  if(argint(0, &pid) < 0 || argaddr(1, &mask) < 0)
+    return -1;
+  return setaffinity(pid, mask);
+}
+
+uint64
+sys_clone(void)
+{
+  uint64 fn, stack, arg;
+
+  if(argaddr(0, &fn) < 0 || argaddr(1, &stack) < 0 || argaddr(2, &arg) < 0)
+    return -1;
+  return clone(fn, stack, arg);
+}
+
+uint64
+sys_join(void)
+{
+  uint64 p;
+
+  if(argaddr(0, &p) < 0)
+    return -1;
+  return join(p);
+}
+
+uint64
+sys_futex_wait(void)
+{
+  uint64 addr;
+  int val;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &val) < 0)
+    return -1;
+  return futexwait(addr, val);
+}
+
+uint64
+sys_futex_wake(void)
+{
+  uint64 addr;
+  int n;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return futexwake(addr, n);
+}
+
+// report scheduler statistics.
+uint64
+sys_schedstat(void)
+{
+  uint64 addr;
+  struct schedstat st;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  memset(&st, 0, sizeof(st));
+  schedstats(&st);
+  if(copyout(myproc()->pagetable, addr, (char *)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
@@ -0,0 +1,200 @@
+//
+// Timers for the sleep() system call: a hierarchical timer wheel.
+//
+// Each level of the wheel has NSLOT slots. A timer due within
+// NSLOT ticks of the wheel's clock goes in the level-0 slot for
+// its tick; later timers go in a slot of a higher level, each
+// slot of level l covering NSLOT^l ticks. When the clock reaches
+// the start of a higher-level slot, the timers in it cascade down
+// to lower levels, so adding and expiring a timer takes constant
+// time however many are pending.
+//
+// timerrun() is called from clockintr() on each tick a CPU sees,
+// and wakes only the owners of expired timers. Idle CPUs skip
+// ticks (see idle() in proc.c); the last one to go idle asks for
+// a timer interrupt at timernext().
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define SLOTBITS 6
+#define NSLOT (1 << SLOTBITS)
+#define SLOTMASK (NSLOT - 1)
+#define NLEVEL 4
+#define MAXDELAY ((1U << (NLEVEL*SLOTBITS)) - 1)
+
+struct timer {
+  uint expires;           // tick at which to wake the owner
+  struct timer *next;     // next timer in the same slot
+  struct timer **pprev;   // what points to this timer; 0 once expired
+};
+
+struct {
+  struct spinlock lock;
+  uint clock;                         // next tick for timerrun() to expire
+  int n;                              // number of pending timers
+  struct timer *slot[NLEVEL][NSLOT];
+} wheel;
+
+void
+wheelinit(void)
+{
+  initlock(&wheel.lock, "timer");
+  wheel.clock = ticks;
+}
+
+// Put t in the slot for t->expires. Caller holds wheel.lock.
+static void
+insert(struct timer *t)
+{
+  uint delay = t->expires - wheel.clock;
+  struct timer **head;
+  int l;
+
+  if((int)delay < 0){
+    // already due; expire it on the next tick.
+    head = &wheel.slot[0][wheel.clock & SLOTMASK];
+  } else {
+    // a later timer goes in the last slot, and is put
+    // back in the wheel when that slot cascades.
+    if(delay > MAXDELAY)
+      delay = MAXDELAY;
+    for(l = 0; l < NLEVEL-1; l++){
+      if(delay < (1U << ((l+1)*SLOTBITS)))
+        break;
+    }
+    head = &wheel.slot[l][((wheel.clock + delay) >> (l*SLOTBITS)) & SLOTMASK];
+  }
+  t->next = *head;
+  if(t->next)
+    t->next->pprev = &t->next;
+  t->pprev = head;
+  *head = t;
+}
+
+static void
+unlink(struct timer *t)
+{
+  if(t->next)
+    t->next->pprev = t->pprev;
+  *t->pprev = t->next;
+  t->pprev = 0;
+}
+
+// Re-insert the timers of slot i at level l, which the
+// clock has just reached.
+static void
+cascade(int l, int i)
+{
+  struct timer *t, *next;
+
+  t = wheel.slot[l][i];
+  wheel.slot[l][i] = 0;
+  for(; t; t = next){
+    next = t->next;
+    insert(t);
+  }
+}
+
+// Expire all timers due by tick now, waking their owners.
+void
+timerrun(uint now)
+{
+  struct timer *t;
+  int i, l;
+
+  acquire(&wheel.lock);
+  if(wheel.n == 0){
+    // nothing to cascade or expire; skip straight to now.
+    if((int)(now + 1 - wheel.clock) > 0)
+      wheel.clock = now + 1;
+    release(&wheel.lock);
+    return;
+  }
+  while((int)(now - wheel.clock) >= 0){
+    i = wheel.clock & SLOTMASK;
+    for(l = 1; i == 0 && l < NLEVEL; l++){
+      i = (wheel.clock >> (l*SLOTBITS)) & SLOTMASK;
+      cascade(l, i);
+    }
+    i = wheel.clock & SLOTMASK;
+    while((t = wheel.slot[0][i]) != 0){
+      unlink(t);
+      wheel.n--;
+      wakeup(t);
+    }
+    wheel.clock++;
+  }
+  release(&wheel.lock);
+}
+
+// The tick at which timerrun() next has work to do, either
+// expiring a timer or cascading a slot that holds some, or
+// -1 if there are no timers.
+uint64
+timernext(void)
+{
+  uint base, delta, min = -1;
+  uint64 next;
+  int i, l, shift;
+
+  acquire(&wheel.lock);
+  if(wheel.n == 0){
+    release(&wheel.lock);
+    return -1;
+  }
+  for(l = 0; l < NLEVEL; l++){
+    shift = l*SLOTBITS;
+    base = wheel.clock >> shift;
+    // slot base comes up next only if the clock is at its
+    // first tick; otherwise it's the slot furthest away.
+    i = (wheel.clock & ((1U << shift) - 1)) == 0 ? 0 : 1;
+    for(; i <= NSLOT; i++){
+      if(wheel.slot[l][(base + i) & SLOTMASK] == 0)
+        continue;
+      delta = ((base + i) << shift) - wheel.clock;
+      if(delta < min)
+        min = delta;
+      break;
+    }
+  }
+  next = (uint)(wheel.clock + min);
+  release(&wheel.lock);
+  return next;
+}
+
+// Sleep for n ticks. returns 0, or -1 if the process
+// was killed.
+int
+timersleep(int n)
+{
+  struct timer t;
+  uint chunk;
+
+  acquire(&wheel.lock);
+  while(n > 0){
+    // insert() compares expires with the clock as a signed
+    // difference, so sleep at most MAXDELAY ticks at a time.
+    chunk = n < MAXDELAY ? n : MAXDELAY;
+    n -= chunk;
+    t.expires = ticks + chunk;
+    insert(&t);
+    wheel.n++;
+    while(t.pprev){
+      if(myproc()->killed){
+        unlink(&t);
+        wheel.n--;
+        release(&wheel.lock);
+        return -1;
+      }
+      sleep(&t, &wheel.lock);
+    }
+  }
+  release(&wheel.lock);
+  return 0;
+}
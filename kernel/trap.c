@@ -8,9 +8,16 @@
 
 struct spinlock tickslock;
 uint ticks;
+uint64 ntimerintr;  // timer interrupts, on all CPUs
 
 extern char trampoline[], uservec[], userret[];
 
+// in usercopy.S.
+extern char ucopystart[], ucopyend[], ucopyfail[];
+
+// in start.c.
+extern uint64 timer_scratch[NCPU][6];
+
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
 
@@ -65,6 +72,17 @@ usertrap(void)
     intr_on();
 
     syscall();
+  } else if(r_scause() == 12 || r_scause() == 13 || r_scause() == 15){
+    // page fault. vmfault() may have to read the page from
+    // disk, so turn interrupts on, as for a system call,
+    // once done with scause and stval.
+    uint64 scause = r_scause(), stval = r_stval();
+    intr_on();
+    if(vmfault(p->pagetable, stval, scause == 15) != 0){
+      printf("usertrap(): unexpected scause %p pid=%d\n", scause, p->pid);
+      printf("            sepc=%p stval=%p\n", p->trapframe->epc, stval);
+      p->killed = 1;
+    }
   } else if((which_dev = devintr()) != 0){
     // ok
   } else {
@@ -119,13 +137,14 @@ usertrapret(void)
   w_sepc(p->trapframe->epc);
 
   // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  // the same ASID as the kernel page table; see kvmswitch().
+  uint64 satp = MAKE_SATP(p->pagetable, SATP2ASID(r_satp()));
 
   // jump to trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
+  ((void (*)(uint64,uint64))fn)(p->tfva, satp);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -143,7 +162,18 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
-  if((which_dev = devintr()) == 0){
+  if((scause == 13 || scause == 15) &&
+     sepc >= (uint64)ucopystart && sepc < (uint64)ucopyend){
+    // a page fault in copyin() or copyout(). fix it up as
+    // usertrap() would, with interrupts on if the copy had
+    // them on, and retry; or else make the copy fail.
+    uint64 stval = r_stval();
+    if(sstatus & SSTATUS_SPIE)
+      intr_on();
+    if(vmfault(myproc()->pagetable, stval, scause == 15) != 0)
+      sepc = (uint64)ucopyfail;
+    intr_off();
+  } else if((which_dev = devintr()) == 0){
     printf("scause %p\n", scause);
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
     panic("kerneltrap");
@@ -159,18 +189,59 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
-void
-clockintr()
+// Bring ticks up to date with the time CSR, which keeps
+// counting while idle CPUs skip timer interrupts.
+// returns the new value of ticks.
+uint
+tickupdate(void)
 {
+  uint now = r_time() / TICKCYCLES;
+
   acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
+  if((int)(now - ticks) > 0)
+    ticks = now;
+  now = ticks;
   release(&tickslock);
+  return now;
+}
+
+void
+clockintr()
+{
+  timerrun(tickupdate());
+}
+
+// Ask for a timer interrupt on this CPU once the time CSR
+// reaches when, in place of any earlier request. -1 means
+// never. timervec turns the timer off each time it fires.
+void
+timerarm(uint64 when)
+{
+  *(uint64*)KCLINT_MTIMECMP(cpuid()) = when;
+}
+
+// did the timer fire since the last call? timervec sets the
+// flag in this CPU's timer_scratch[], and a software interrupt
+// that finds it clear is an IPI.
+static int
+timerfired(void)
+{
+  return __sync_lock_test_and_set(&timer_scratch[cpuid()][5], 0);
+}
+
+// Send an IPI to cpu, to wake it from wfi in scheduler().
+// timervec in kernelvec.S turns the machine-mode software
+// interrupt into a supervisor one.
+void
+ipi(int cpu)
+{
+  *(volatile uint32*)KCLINT_MSIP(cpu) = 1;
 }
 
 // check if it's an external interrupt or software interrupt,
 // and handle it.
 // returns 2 if timer interrupt,
+// 3 if IPI,
 // 1 if other device,
 // 0 if not recognized.
 int
@@ -202,16 +273,27 @@ devintr()
     return 1;
   } else if(scause == 0x8000000000000001L){
     // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // or an IPI, forwarded by timervec in kernelvec.S.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
     w_sip(r_sip() & ~2);
 
+    // an IPI may be asking for a TLB flush; see uvmflush().
+    uvmipi();
+
+    if(!timerfired()){
+      // an IPI; it has done its job by waking this CPU.
+      return 3;
+    }
+
+    // every CPU that is running something gets a tick, for
+    // preemption; the first one to see each tick also runs
+    // the timer wheel.
+    __sync_fetch_and_add(&ntimerintr, 1);
+    clockintr();
+    timerarm((r_time() / TICKCYCLES + 1) * TICKCYCLES);
+
     return 2;
   } else {
     return 0;
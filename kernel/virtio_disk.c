@@ -22,10 +22,10 @@
 
 static struct disk {
   // the virtio driver and device mostly communicate through a set of
-  // structures in RAM. pages[] allocates that memory. pages[] is a
-  // global (instead of calls to kalloc()) because it must consist of
-  // two contiguous pages of page-aligned physical memory.
-  char pages[2*PGSIZE];
+  // structures in RAM. pages[] holds that memory. it must consist of
+  // two contiguous pages of page-aligned physical memory, so it
+  // comes from kalloc_order(1).
+  char *pages;
 
   // pages[] is divided into three regions (descriptors, avail, and
   // used), as explained in Section 2.6 of the virtio specification
@@ -63,7 +63,9 @@ static struct disk {
   struct {
     struct buf *b;
     char status;
+    char async;    // started by virtio_disk_start()
   } info[NUM];
+  int nasync;      // async requests in flight
 
   // disk command headers.
   // one-for-one with descriptors, for convenience.
@@ -71,7 +73,7 @@ static struct disk {
   
   struct spinlock vdisk_lock;
   
-} __attribute__ ((aligned (PGSIZE))) disk;
+} disk;
 
 void
 virtio_disk_init(void)
@@ -122,7 +124,9 @@ virtio_disk_init(void)
   if(max < NUM)
     panic("virtio disk max queue too short");
   *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
-  memset(disk.pages, 0, sizeof(disk.pages));
+  if((disk.pages = kalloc_order(1)) == 0)
+    panic("virtio disk kalloc");
+  memset(disk.pages, 0, 2*PGSIZE);
   *R(VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk.pages) >> PGSHIFT;
 
   // desc = pages -- num * virtq_desc
@@ -200,26 +204,17 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// Format a request to transfer b in the descriptors idx[],
+// and hand it to the device. Caller holds disk.vdisk_lock.
+static void
+submit(struct buf *b, int write, int *idx)
 {
   uint64 sector = b->blockno * (BSIZE / 512);
 
-  acquire(&disk.vdisk_lock);
-
   // the spec's Section 5.2 says that legacy block operations use
   // three descriptors: one for type/reserved/sector, one for the
   // data, one for a 1-byte status result.
 
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
-  }
-
   // format the three descriptors.
   // qemu's virtio-blk.c reads them.
 
@@ -267,6 +262,23 @@ virtio_disk_rw(struct buf *b, int write)
   __sync_synchronize();
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
+
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  acquire(&disk.vdisk_lock);
+
+  // allocate the three descriptors.
+  int idx[3];
+  while(1){
+    if(alloc3_desc(idx) == 0) {
+      break;
+    }
+    sleep(&disk.free[0], &disk.vdisk_lock);
+  }
+
+  submit(b, write, idx);
 
   // Wait for virtio_disk_intr() to say request has finished.
   while(b->disk == 1) {
@@ -279,6 +291,27 @@ virtio_disk_rw(struct buf *b, int write)
   release(&disk.vdisk_lock);
 }
 
+// Start reading b, which is locked, without waiting;
+// virtio_disk_intr() calls bdone(b) when the read is done.
+// returns -1, having started nothing, if that would leave
+// too few descriptors for synchronous requests.
+int
+virtio_disk_start(struct buf *b)
+{
+  int idx[3];
+
+  acquire(&disk.vdisk_lock);
+  if(disk.nasync >= NUM/3 - 1 || alloc3_desc(idx) != 0){
+    release(&disk.vdisk_lock);
+    return -1;
+  }
+  disk.info[idx[0]].async = 1;
+  disk.nasync++;
+  submit(b, 0, idx);
+  release(&disk.vdisk_lock);
+  return 0;
+}
+
 void
 virtio_disk_intr()
 {
@@ -306,7 +339,16 @@ virtio_disk_intr()
 
     struct buf *b = disk.info[id].b;
     b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    if(disk.info[id].async){
+      // no one is waiting to free the descriptors.
+      disk.info[id].async = 0;
+      disk.info[id].b = 0;
+      free_chain(id);
+      disk.nasync--;
+      bdone(b);
+    } else {
+      wakeup(b);
+    }
 
     disk.used_idx += 1;
   }
@@ -3,6 +3,10 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "space.h"
 #include "defs.h"
 #include "fs.h"
 
@@ -21,8 +25,7 @@ kvmmake(void)
 {
   pagetable_t kpgtbl;
 
-  kpgtbl = (pagetable_t) kalloc();
-  memset(kpgtbl, 0, PGSIZE);
+  kpgtbl = (pagetable_t) kalloc_zeroed();
 
   // uart registers
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
@@ -33,6 +36,9 @@ kvmmake(void)
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
 
+  // CLINT, for ipi() and timerarm().
+  kvmmap(kpgtbl, KCLINT, CLINT, 0x10000, PTE_R | PTE_W);
+
   // map kernel text executable and read-only.
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
@@ -41,14 +47,28 @@ kvmmake(void)
 
   // map the trampoline for trap entry/exit to
   // the highest virtual address in the kernel.
+  // kernel stacks go below it, as processes need
+  // them; see kvmmapstack().
   kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
 
-  // map kernel stacks
-  proc_mapstacks(kpgtbl);
-  
   return kpgtbl;
 }
 
+// Map a new kernel stack page pa at va, for growprocs() in
+// proc.c. Every process's kernel page table shares the page-
+// table pages below kernel_pagetable's level-2 PTEs (see
+// kvmcreate()), so they all see it. returns -1 if out of memory.
+int
+kvmmapstack(uint64 va, uint64 pa)
+{
+  if(mappages(kernel_pagetable, va, PGSIZE, pa, PTE_R | PTE_W) != 0)
+    return -1;
+  // no CPU has used va while it was unmapped, so none can
+  // have cached it as invalid; but fence this one anyway.
+  sfence_vma();
+  return 0;
+}
+
 // Initialize the one kernel_pagetable
 void
 kvminit(void)
@@ -61,10 +81,252 @@ kvminit(void)
 void
 kvminithart()
 {
-  w_satp(MAKE_SATP(kernel_pagetable));
+  w_satp(MAKE_SATP(kernel_pagetable, 0));
   sfence_vma();
 }
 
+// Each process also has a kernel page table of its own, which
+// the scheduler switches to while the process runs. It maps the
+// kernel just like kernel_pagetable, and maps the process's user
+// memory (everything below MAXUVA) as well, so that copyin() and
+// copyout() can use user addresses directly. The user memory
+// mappings aren't copies: all of it lies in the range of the
+// first level-2 PTE, and the user page table and the kernel one
+// share the level-1 page-table page that PTE points to (see
+// uvmcreate()). Any change to the process's memory is seen
+// through both page tables without having to be made twice.
+
+// Make a kernel page table for a process whose user page
+// table is pagetable. returns 0 if out of memory.
+pagetable_t
+kvmcreate(pagetable_t pagetable)
+{
+  pagetable_t kpgtbl;
+
+  if((kpgtbl = (pagetable_t) kalloc()) == 0)
+    return 0;
+  // the kernel's level-2 PTEs never change after kvminit(),
+  // so kpgtbl can share the page-table pages below them.
+  memmove(kpgtbl, kernel_pagetable, PGSIZE);
+  kvmuser(kpgtbl, pagetable);
+  return kpgtbl;
+}
+
+// Make process kernel page table kpgtbl map the user memory
+// of pagetable, as when exec() replaces the user page table.
+// the caller must sfence_vma() if kpgtbl is in use.
+void
+kvmuser(pagetable_t kpgtbl, pagetable_t pagetable)
+{
+  kpgtbl[0] = pagetable[0];
+}
+
+// Free a page table made by kvmcreate().
+void
+kvmfree(pagetable_t kpgtbl)
+{
+  kfree((void*)kpgtbl);
+}
+
+// Address-space identifiers.
+//
+// Each process runs with an ASID of its own, which tags the TLB
+// entries loaded through its page tables, so that a context
+// switch needn't flush the TLB, and neither does trampoline.S.
+// The process's user and kernel page tables share the ASID:
+// they map user memory identically, and the kernel-only
+// mappings have no PTE_U, so user code can't use them.
+// The threads of a process share its ASID, which belongs to
+// their struct space. kernel_pagetable, which the scheduler
+// runs on, has ASID 0.
+//
+// ASIDs are handed out in increasing order, and never reused
+// until they run out. Then a new generation starts: processes
+// get new ASIDs as they are next scheduled, and each CPU flushes
+// its whole TLB before switching to an ASID of the new
+// generation. A process's old ASID is simply abandoned when it
+// exits.
+//
+// A change to a process's page table is flushed at once on the
+// CPU that makes it (see uvmflush()). Other CPUs running the
+// process's threads get an IPI and flush too; the rest are
+// marked in the space's stale mask, and flush the ASID when
+// they next run one of its threads.
+
+struct {
+  struct spinlock lock;
+  uint64 max;   // largest ASID the hardware supports
+  uint64 gen;   // current generation
+  uint64 next;  // next ASID of this generation to hand out
+} asids;
+
+// Find out how many ASID bits the hardware implements.
+// Call after kvminithart().
+void
+asidinit(void)
+{
+  initlock(&asids.lock, "asid");
+  w_satp(MAKE_SATP(kernel_pagetable, SATP_ASIDMASK));
+  asids.max = SATP2ASID(r_satp());
+  w_satp(MAKE_SATP(kernel_pagetable, 0));
+  sfence_vma();
+  asids.gen = 1;
+  asids.next = 1;
+}
+
+// Switch this CPU to p's kernel page table with p's ASID,
+// first giving p a new ASID if its old one is from an earlier
+// generation. Or, if p is 0, or an exiting thread that has
+// left its space, switch to kernel_pagetable.
+// Caller must hold p->lock.
+void
+kvmswitch(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  struct space *s;
+  uint64 asid, gen, me = 1L << cpuid();
+
+  if(p == 0 || p->space == 0){
+    // the scheduler touches only kernel memory, whose
+    // mappings never change; no flush is needed.
+    w_satp(MAKE_SATP(kernel_pagetable, 0));
+    return;
+  }
+  s = p->space;
+
+  if(asids.max == 0){
+    // no ASIDs; flush on every switch.
+    __sync_fetch_and_and(&s->stale, ~me);
+    w_satp(MAKE_SATP(p->kpagetable, 0));
+    sfence_vma();
+    return;
+  }
+
+  // acquire() also orders the caller's setting of c->proc
+  // before the read of s->stale below; see uvmflush().
+  acquire(&asids.lock);
+  if(s->asid >> 16 != asids.gen){
+    if(asids.next > asids.max){
+      asids.gen++;
+      asids.next = 1;
+    }
+    s->asid = (asids.gen << 16) | asids.next++;
+  }
+  gen = asids.gen;
+  release(&asids.lock);
+  asid = s->asid & SATP_ASIDMASK;
+
+  w_satp(MAKE_SATP(p->kpagetable, asid));
+  if(c->asidgen != gen){
+    // this CPU may hold entries for ASIDs that have
+    // since been handed out again.
+    __sync_fetch_and_and(&s->stale, ~me);
+    sfence_vma();
+    c->asidgen = gen;
+  } else if(s->stale & me){
+    // the page table has changed since this CPU last ran
+    // one of the space's threads. clear the bit first, so
+    // that a change made meanwhile isn't missed.
+    __sync_fetch_and_and(&s->stale, ~me);
+    sfence_vma_asid(asid);
+  }
+}
+
+// Flush TLB entries for [va, va+len) in pagetable, if it is
+// the current process's: on this CPU now, and on the others
+// when they next run one of its threads (see kvmswitch()).
+// Unless the change only added mappings, also on CPUs that run
+// other threads of the process right now, before returning;
+// after an added mapping they at worst take a fault that
+// finds it (see spurious()).
+// Must not be called with a spinlock held if other threads
+// might be running, except for a trapframe (above MAXUVA),
+// which only its own thread uses.
+static void
+flush(pagetable_t pagetable, uint64 va, uint64 len, int added)
+{
+  struct proc *p = myproc();
+  struct space *s;
+  struct cpu *c;
+  struct proc *q;
+  uint64 asid, a, me, wait;
+
+  if(p == 0 || pagetable != p->pagetable)
+    return;
+  s = p->space;
+
+  push_off();
+  me = 1L << cpuid();
+  __sync_fetch_and_or(&s->stale, ((1L << NCPU) - 1) & ~me);
+  asid = SATP2ASID(r_satp());
+  if(asid == 0 || len > 64*PGSIZE){
+    if(asid == 0)
+      sfence_vma();
+    else
+      sfence_vma_asid(asid);
+  } else {
+    for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE)
+      sfence_vma_page(a, asid);
+  }
+
+  // interrupt the other CPUs running threads of s. the
+  // fence pairs with kvmswitch(): either a CPU that is
+  // switching to s sees its stale bit, or we see c->proc.
+  wait = 0;
+  if(!added && va < MAXUVA && s->ref > 1){
+    __sync_synchronize();
+    for(c = cpus; c < &cpus[NCPU]; c++){
+      q = c->proc;
+      if(c != mycpu() && q && q->space == s){
+        wait |= 1L << (c - cpus);
+        ipi(c - cpus);
+      }
+    }
+  }
+  pop_off();
+  if(wait && !intr_get())
+    panic("uvmflush");
+
+  // they must stop using the old entries before the caller
+  // frees or reuses the pages. uvmipi() clears the bit.
+  while(wait){
+    __sync_synchronize();
+    for(c = cpus; c < &cpus[NCPU]; c++){
+      a = 1L << (c - cpus);
+      q = c->proc;
+      if((wait & a) && ((s->stale & a) == 0 || q == 0 || q->space != s))
+        wait &= ~a;
+    }
+  }
+}
+
+// Flush TLB entries for [va, va+len) in pagetable after
+// mappings were removed or changed; see flush().
+void
+uvmflush(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  flush(pagetable, va, len, 0);
+}
+
+// Flush this CPU's TLB for the current process's ASID if
+// another thread changed the page table; for an IPI sent
+// by uvmflush(). Interrupts are off.
+void
+uvmipi(void)
+{
+  struct proc *p = myproc();
+  struct space *s;
+  uint64 asid, me = 1L << cpuid();
+
+  if(p == 0 || (s = p->space) == 0 || (s->stale & me) == 0)
+    return;
+  __sync_fetch_and_and(&s->stale, ~me);
+  if((asid = SATP2ASID(r_satp())) == 0)
+    sfence_vma();
+  else
+    sfence_vma_asid(asid);
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page-table pages.
@@ -77,26 +339,88 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// If va lies in a superpage, returns the leaf PTE in the
+// level-1 page-table page that maps the whole superpage.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
+  return walklevel(pagetable, va, alloc, 0);
+}
+
+// Like walk(), but stops at the given level (0 or 1) of
+// the page table, and sets *levelp (if not null) to the
+// level of the returned PTE.
+pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int alloc, int *levelp)
+{
+  int level;
+
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
+  for(level = 2; level > 0; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte)){
+        if(levelp)
+          *levelp = level;
+        return pte;
+      }
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
+  if(levelp)
+    *levelp = 0;
   return &pagetable[PX(0, va)];
 }
 
+// Return the level-1 PTE for va, which maps either a
+// superpage or a level-0 page-table page; allocate the
+// level-1 page-table page if alloc != 0.
+static pte_t *
+walksuper(pagetable_t pagetable, uint64 va, int alloc)
+{
+  pte_t *pte = &pagetable[PX(2, va)];
+
+  if(*pte & PTE_V) {
+    if(PTE_LEAF(*pte))
+      panic("walksuper");
+    pagetable = (pagetable_t)PTE2PA(*pte);
+  } else {
+    if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
+      return 0;
+    *pte = PA2PTE(pagetable) | PTE_V;
+  }
+  return &pagetable[PX(1, va)];
+}
+
+// Turn the superpage leaf *pte into a level-0 page-table
+// page of 4096-byte mappings of the same memory, with the
+// same permissions, so that part of it can be unmapped or
+// copied. Each page then has its own reference count.
+// returns 0, or -1 if out of memory.
+static int
+demote(pte_t *pte)
+{
+  pagetable_t pagetable;
+  uint64 pa;
+  int i;
+
+  if((pagetable = (pagetable_t)kalloc_zeroed()) == 0)
+    return -1;
+  pa = PTE2PA(*pte);
+  for(i = 0; i < 512; i++)
+    pagetable[i] = PA2PTE(pa + i*PGSIZE) | PTE_FLAGS(*pte);
+  ksplit((void*)pa, SUPERORDER);
+  *pte = PA2PTE(pagetable) | PTE_V;
+  return 0;
+}
+
 // Look up a virtual address, return the physical address,
 // or 0 if not mapped.
 // Can only be used to look up user pages.
@@ -105,11 +429,12 @@ walkaddr(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
   uint64 pa;
+  int level;
 
   if(va >= MAXVA)
     return 0;
 
-  pte = walk(pagetable, va, 0);
+  pte = walklevel(pagetable, va, 0, &level);
   if(pte == 0)
     return 0;
   if((*pte & PTE_V) == 0)
@@ -117,6 +442,8 @@ walkaddr(pagetable_t pagetable, uint64 va)
   if((*pte & PTE_U) == 0)
     return 0;
   pa = PTE2PA(*pte);
+  if(level > 0)
+    pa += PGROUNDDOWN(va) & (SUPERPGSIZE-1);
   return pa;
 }
 
@@ -132,7 +459,10 @@ kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
-// be page-aligned. Returns 0 on success, -1 if walk() couldn't
+// be page-aligned. Where va and pa are both superpage-aligned
+// and at least a superpage remains, maps a whole superpage with
+// one PTE, unless a level-0 page-table page is already there.
+// Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
@@ -146,6 +476,19 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
+    if(a % SUPERPGSIZE == 0 && pa % SUPERPGSIZE == 0 &&
+       last - a >= SUPERPGSIZE - PGSIZE){
+      if((pte = walksuper(pagetable, a, 1)) == 0)
+        return -1;
+      if((*pte & PTE_V) == 0){
+        *pte = PA2PTE(pa) | perm | PTE_V;
+        if(last - a == SUPERPGSIZE - PGSIZE)
+          break;
+        a += SUPERPGSIZE;
+        pa += SUPERPGSIZE;
+        continue;
+      }
+    }
     if((pte = walk(pagetable, a, 1)) == 0)
       return -1;
     if(*pte & PTE_V)
@@ -159,43 +502,116 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   return 0;
 }
 
+// free a page or superpage (low bit set) that uvmunmap() unmapped.
+static void
+freebatched(uint64 pa)
+{
+  if(pa & 1)
+    kfree_order((void*)(pa & ~1L), SUPERORDER);
+  else
+    kfree((void*)pa);
+}
+
+// If a superpage maps va without starting there, demote it,
+// so that the pages on either side of va can be unmapped
+// separately. returns 0, or -1 if out of memory.
+static int
+splitsuper(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  int level;
+
+  if(va % SUPERPGSIZE == 0 || va >= MAXVA)
+    return 0;
+  if((pte = walklevel(pagetable, va, 0, &level)) == 0)
+    return 0;
+  if((*pte & PTE_V) == 0 || level == 0)
+    return 0;
+  return demote(pte);
+}
+
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
-// Optionally free the physical memory.
-void
+// page-aligned. Pages that were never touched (see
+// vmfault()) have no mapping and are skipped. A superpage
+// that is only partly unmapped is demoted first.
+// Optionally free the physical memory, a batch of pages at a
+// time, each once no CPU's TLB can still map it.
+// returns 0, or -1 if there was no memory to demote a
+// superpage, in which case nothing has been unmapped.
+int
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, start, end, batch[16];
   pte_t *pte;
+  int i, n, level;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+  end = va + npages*PGSIZE;
+
+  // only superpages at the ends of the range can be partly
+  // unmapped, so demote those before changing anything.
+  if(splitsuper(pagetable, va) != 0 || splitsuper(pagetable, end) != 0)
+    return -1;
+
+  n = 0;
+  for(a = start = va; a < end; a += PGSIZE){
+    if(n == NELEM(batch)){
+      uvmflush(pagetable, start, a - start);
+      for(i = 0; i < n; i++)
+        freebatched(batch[i]);
+      n = 0;
+      start = a;
+    }
+    if((pte = walklevel(pagetable, a, 0, &level)) == 0)
+      continue;
     if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
+    if(level > 0){
+      if(a % SUPERPGSIZE != 0 || end - a < SUPERPGSIZE)
+        panic("uvmunmap: partial superpage");
+      // low bit set for a superpage.
+      if(do_free)
+        batch[n++] = PTE2PA(*pte) | 1;
+      *pte = 0;
+      a += SUPERPGSIZE - PGSIZE;
+      continue;
+    }
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
-    if(do_free){
-      uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
-    }
+    if(do_free)
+      batch[n++] = PTE2PA(*pte);
     *pte = 0;
   }
+  uvmflush(pagetable, start, end - start);
+  for(i = 0; i < n; i++)
+    freebatched(batch[i]);
+  return 0;
 }
 
 // create an empty user page table.
 // returns 0 if out of memory.
+// the level-1 page-table page for user memory is allocated
+// now, for kvmcreate() to share, and also maps the kernel's
+// devices above MAXUVA, without PTE_U, so that the process's
+// kernel page table can reach them.
 pagetable_t
 uvmcreate()
 {
-  pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable_t pagetable, low, klow;
+
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
+  if((low = (pagetable_t) kalloc_zeroed()) == 0){
+    kfree(pagetable);
+    return 0;
+  }
+  klow = (pagetable_t) PTE2PA(kernel_pagetable[0]);
+  for(int i = PX(1, MAXUVA); i < 512; i++)
+    low[i] = klow[i];
+  pagetable[0] = PA2PTE(low) | PTE_V;
   return pagetable;
 }
 
@@ -209,8 +625,7 @@ uvminit(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
@@ -228,12 +643,11 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -246,7 +660,8 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
+// process size.  Returns the new process size, or oldsz if
+// out of memory (see uvmunmap()).
 uint64
 uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 {
@@ -255,7 +670,8 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 
   if(PGROUNDUP(newsz) < PGROUNDUP(oldsz)){
     int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
-    uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1);
+    if(uvmunmap(pagetable, PGROUNDUP(newsz), npages, 1) != 0)
+      return oldsz;
   }
 
   return newsz;
@@ -286,49 +702,373 @@ freewalk(pagetable_t pagetable)
 void
 uvmfree(pagetable_t pagetable, uint64 sz)
 {
-  if(sz > 0)
-    uvmunmap(pagetable, 0, PGROUNDUP(sz)/PGSIZE, 1);
+  pagetable_t low;
+
+  // no superpage extends past sz, so this can't fail.
+  if(sz > 0 && uvmunmap(pagetable, 0, PGROUNDUP(sz)/PGSIZE, 1) != 0)
+    panic("uvmfree");
+  // the device mappings belong to kernel_pagetable.
+  low = (pagetable_t) PTE2PA(pagetable[0]);
+  for(int i = PX(1, MAXUVA); i < 512; i++)
+    low[i] = 0;
   freewalk(pagetable);
 }
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Copies only the page table: the child shares the
+// parent's physical pages, and writable pages become
+// read-only and copy-on-write in both, to be copied
+// by uvmcow() when one of them writes.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+{
+  return uvmcopyrange(old, new, 0, sz, 0);
+}
+
+// Copy the mappings of [va, va+len) from old to new, sharing
+// the physical pages. Unless share is set, writable pages
+// become copy-on-write in both, as for uvmcopy(). If share is
+// set, both keep using the same pages, and the child's start
+// out clean and read-only, so that vmafault() sees its writes.
+// returns 0 on success, -1 on failure.
+int
+uvmcopyrange(pagetable_t old, pagetable_t new, uint64 va, uint64 len, int share)
 {
   pte_t *pte;
   uint64 pa, i;
   uint flags;
-  char *mem;
+  int level;
 
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
+  for(i = va; i < va + len; i += PGSIZE){
+    if((pte = walklevel(old, i, 0, &level)) == 0)
+      continue;  // never touched; the child will fault it in.
     if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+      continue;
+    if(level > 0){
+      // share 4096-byte pages, so that a write copies only one.
+      if(demote(pte) != 0)
+        goto err;
+      pte = walk(old, i, 0);
+    }
     pa = PTE2PA(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
-      goto err;
+    if(share){
+      flags = PTE_FLAGS(*pte) & ~(PTE_W|PTE_D);
+    } else {
+      if(*pte & PTE_W)
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+      flags = PTE_FLAGS(*pte);
     }
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
+      goto err;
+    kdup((void*)pa);
   }
+  // old's writable PTEs may be cached.
+  uvmflush(old, va, len);
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  uvmunmap(new, va, (i - va) / PGSIZE, 1);
   return -1;
 }
 
+// Handle a write to the copy-on-write page at va: give
+// the process its own writable copy, or, if no one else
+// shares the page any more, just make it writable.
+// returns 0 on success, -1 if va is not a copy-on-write
+// page or there is no memory for the copy.
+int
+uvmcow(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+  if((pte = walk(pagetable, va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U|PTE_COW))
+    return -1;
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+
+  if(krefcount((void*)pa) == 1){
+    *pte = PA2PTE(pa) | flags;
+    return 0;
+  }
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, (char*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | flags;
+  // other threads may still be reading pa through their TLBs.
+  uvmflush(pagetable, va, PGSIZE);
+  kfree((void*)pa);
+  return 0;
+}
+
+// the segment of p's executable that contains va, or 0.
+static struct seg*
+findseg(struct proc *p, uint64 va)
+{
+  struct seg *s;
+
+  for(s = p->space->seg; s < &p->space->seg[p->space->nseg]; s++){
+    if(va >= s->va && va < s->va + s->memsz)
+      return s;
+  }
+  return 0;
+}
+
+// get the page at va of segment s of p's executable.
+// pages holding file contents come from the page cache
+// (pcache.c), reading them in if need be, and are shared;
+// *shared is set for those. returns the page, or 0.
+static char*
+segpage(struct proc *p, struct seg *s, uint64 va, int *shared)
+{
+  char *mem;
+  uint64 n;
+  uint off;
+
+  *shared = 0;
+  n = 0;
+  if(va - s->va < s->filesz)
+    n = s->filesz - (va - s->va);
+  if(n > PGSIZE)
+    n = PGSIZE;
+  if(n == 0)
+    return kalloc_zeroed();
+
+  off = s->off + (va - s->va);
+  *shared = 1;
+  ilock(p->space->exe);
+  mem = pcacheread(p->space->exe, off, n);
+  iunlock(p->space->exe);
+  return mem;
+}
+
+// Back the whole superpage-aligned region around heap
+// address va with one superpage, if the region lies entirely
+// below the heap's end and outside the executable, nothing in it is
+// mapped yet, and a physically contiguous block is free.
+// returns 0 on success, -1 to fall back to a single page.
+static int
+supermap(struct proc *p, uint64 va)
+{
+  uint64 base = SUPERPGROUNDDOWN(va);
+  struct seg *s;
+  pte_t *pte;
+  char *mem;
+
+  if(base + SUPERPGSIZE > p->space->sz)
+    return -1;
+  for(s = p->space->seg; s < &p->space->seg[p->space->nseg]; s++){
+    if(s->va < base + SUPERPGSIZE && base < s->va + s->memsz)
+      return -1;
+  }
+  if((pte = walksuper(p->pagetable, base, 1)) == 0 || (*pte & PTE_V))
+    return -1;
+  if((mem = kalloc_order(SUPERORDER)) == 0)
+    return -1;
+  memset(mem, 0, SUPERPGSIZE);
+  *pte = PA2PTE(mem) | PTE_W|PTE_X|PTE_R|PTE_U|PTE_V;
+  return 0;
+}
+
+// Is the access that faulted at va allowed by the page table
+// as it is now? Then another thread fixed the fault, and this
+// CPU only has to flush its stale TLB entry.
+static int
+spurious(pagetable_t pagetable, uint64 va, int write)
+{
+  pte_t *pte;
+
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+    return 0;
+  if((*pte & (write ? PTE_W : PTE_R)) == 0)
+    return 0;
+  sfence_vma_page(PGROUNDDOWN(va), SATP2ASID(r_satp()));
+  return 1;
+}
+
+// Handle a page fault at va in the current process, on
+// behalf of usertrap() or copyin()/copyout(). Addresses
+// above the heap are left to vmafault(), for mmap() regions.
+// A page of the executable is read in from its inode; any other page
+// below the heap's end that has never been touched (e.g. since
+// sbrk() grew the process) gets a fresh zeroed page, or a
+// whole superpage if supermap() can manage it; a
+// write to a copy-on-write page gets a private copy.
+// returns 0 if the fault was fixed, -1 if the access
+// is illegal or there is no memory.
+static int
+fault(struct proc *p, uint64 va, int write)
+{
+  pagetable_t pagetable = p->pagetable;
+  struct seg *s;
+  pte_t *pte;
+  char *mem;
+  int perm, shared;
+
+  if(va >= p->space->sz){
+    // maybe a page of an mmap() region.
+    if(vmafault(p, va, write) != 0)
+      return -1;
+    flush(pagetable, va, PGSIZE, 1);
+    p->nfault++;
+    return 0;
+  }
+  va = PGROUNDDOWN(va);
+
+  pte = walk(pagetable, va, 0);
+  if(pte && (*pte & PTE_V)){
+    // mapped, so only a copy-on-write fault can be fixed.
+    // this also keeps the stack guard page off limits.
+    if(!write || uvmcow(pagetable, va) != 0)
+      return -1;
+  } else if((s = findseg(p, va)) != 0){
+    // reading the file may sleep, which a caller
+    // holding a spinlock can't do; see vmprefault().
+    if(!intr_get())
+      return -1;
+    if((mem = segpage(p, s, va, &shared)) == 0)
+      return -1;
+    perm = s->perm | PTE_U;
+    if(shared && (perm & PTE_W))
+      perm = (perm & ~PTE_W) | PTE_COW;
+    if(mappages(pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+      kfree(mem);
+      return -1;
+    }
+  } else if(supermap(p, va) != 0){
+    if((mem = kalloc_zeroed()) == 0)
+      return -1;
+    if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+      kfree(mem);
+      return -1;
+    }
+  }
+  // a copy-on-write fault was flushed by uvmcow().
+  flush(pagetable, va, PGSIZE, 1);
+  p->nfault++;
+  return 0;
+}
+
+// Handle a page fault at va in the current process; see fault().
+// If other threads share the process's memory, they may be
+// faulting or changing it too, so take the space's vmlock,
+// which means the fault can only be fixed with interrupts on.
+int
+vmfault(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  struct space *sp;
+  int r;
+
+  if(p == 0 || pagetable != p->pagetable || va >= MAXVA)
+    return -1;
+  sp = p->space;
+  if(sp->ref == 1)
+    return fault(p, va, write);
+
+  // ref can't go from 1 to more while this thread is here,
+  // since only a thread of the space can clone() another.
+  if(!intr_get())
+    return spurious(pagetable, va, write) ? 0 : -1;
+  acquiresleep(&sp->vmlock);
+  if(spurious(pagetable, va, write))
+    r = 0;
+  else
+    r = fault(p, va, write);
+  releasesleep(&sp->vmlock);
+  return r;
+}
+
+// Page in the parts of [va, va+n) in the current process
+// that would have to be read from a file: its executable or
+// an mmap()ed file. Called before copying to or from a user
+// buffer while holding a lock that vmfault() can't sleep
+// under, or the lock of an inode that might be the one to be
+// read. If other threads share the memory, vmfault() can't fix
+// any fault without sleeping, so page in everything, and if
+// the copy will write the buffer, make it writable too; so
+// callers pass no more than the copy can transfer, not all
+// of a buffer that a read will fill only part of.
+// Faults that can't be fixed here are left for the copy to
+// report.
+void
+vmprefault(uint64 va, uint64 n, int write)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 a, end;
+  pte_t *pte;
+  int threads = p->space->ref > 1;
+
+  if(va >= MAXUVA)
+    return;
+  end = va + n;
+  if(end > MAXUVA || end < va)
+    end = MAXUVA;
+  for(a = PGROUNDDOWN(va); a < end; a += PGSIZE){
+    if(!threads && (a < p->space->sz ? findseg(p, a) == 0 :
+                    ((v = findvma(p, a)) == 0 || v->f == 0)))
+      continue;
+    pte = walk(p->pagetable, a, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0)
+      vmfault(p->pagetable, a, threads && write);
+    else if(threads && write && (*pte & PTE_W) == 0)
+      vmfault(p->pagetable, a, 1);
+  }
+}
+
+// count the superpages mapped in a user page table.
+uint64
+uvmsuperpages(pagetable_t pagetable)
+{
+  pagetable_t l1;
+  uint64 n;
+  int i, j;
+
+  n = 0;
+  for(i = 0; i < 512; i++){
+    if((pagetable[i] & PTE_V) == 0 || PTE_LEAF(pagetable[i]))
+      continue;
+    l1 = (pagetable_t)PTE2PA(pagetable[i]);
+    for(j = 0; j < 512; j++){
+      if((l1[j] & PTE_V) && PTE_LEAF(l1[j]) && (l1[j] & PTE_U))
+        n++;
+    }
+  }
+  return n;
+}
+
+// count the pages actually mapped in the first sz bytes
+// of a user address space.
+uint64
+uvmresident(pagetable_t pagetable, uint64 sz)
+{
+  pte_t *pte;
+  uint64 a, n;
+
+  n = 0;
+  for(a = 0; a < sz; a += PGSIZE){
+    if((pte = walk(pagetable, a, 0)) != 0 && (*pte & PTE_V))
+      n++;
+  }
+  return n;
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
+// clears PTE_R and PTE_W too, since copyin() and copyout()
+// run in supervisor mode, which can use non-PTE_U pages.
 void
 uvmclear(pagetable_t pagetable, uint64 va)
 {
@@ -337,7 +1077,23 @@ uvmclear(pagetable_t pagetable, uint64 va)
   pte = walk(pagetable, va, 0);
   if(pte == 0)
     panic("uvmclear");
-  *pte &= ~PTE_U;
+  *pte &= ~(PTE_U | PTE_R | PTE_W);
+}
+
+// Call ucopy() or ucopystr() (usercopy.S) with sstatus.SUM set,
+// so that supervisor mode may use the current process's user
+// pages, which its kernel page table maps. A page fault in the
+// copy goes to kerneltrap(), which calls vmfault() to fix it
+// or else makes the copy fail.
+static int
+ucall(int (*fn)(char*, char*, uint64), char *dst, char *src, uint64 n)
+{
+  int r;
+
+  w_sstatus(r_sstatus() | SSTATUS_SUM);
+  r = fn(dst, src, n);
+  w_sstatus(r_sstatus() & ~SSTATUS_SUM);
+  return r;
 }
 
 // Copy from kernel to user.
@@ -346,10 +1102,25 @@ uvmclear(pagetable_t pagetable, uint64 va)
 int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
+  struct proc *p = myproc();
   uint64 n, va0, pa0;
+  pte_t *pte;
 
+  if(p != 0 && pagetable == p->pagetable){
+    if(dstva >= MAXUVA || len > MAXUVA - dstva)
+      return -1;
+    return ucall(ucopy, (char*)dstva, src, len);
+  }
+
+  // not the current process's memory, as for exec()'s
+  // new stack: look up each page.
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
+    if(va0 >= MAXUVA)
+      return -1;
+    pte = walk(pagetable, va0, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_W) == 0)
+      return -1;
     pa0 = walkaddr(pagetable, va0);
     if(pa0 == 0)
       return -1;
@@ -366,69 +1137,31 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 }
 
 // Copy from user to kernel.
-// Copy len bytes to dst from virtual address srcva in a given page table.
+// Copy len bytes to dst from virtual address srcva in a given page table,
+// which must be the current process's.
 // Return 0 on success, -1 on error.
 int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
-  uint64 n, va0, pa0;
-
-  while(len > 0){
-    va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
-    n = PGSIZE - (srcva - va0);
-    if(n > len)
-      n = len;
-    memmove(dst, (void *)(pa0 + (srcva - va0)), n);
-
-    len -= n;
-    dst += n;
-    srcva = va0 + PGSIZE;
-  }
-  return 0;
+  if(pagetable != myproc()->pagetable)
+    panic("copyin");
+  if(srcva >= MAXUVA || len > MAXUVA - srcva)
+    return -1;
+  return ucall(ucopy, dst, (char*)srcva, len);
 }
 
 // Copy a null-terminated string from user to kernel.
 // Copy bytes to dst from virtual address srcva in a given page table,
-// until a '\0', or max.
+// which must be the current process's, until a '\0', or max.
 // Return 0 on success, -1 on error.
 int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
-  uint64 n, va0, pa0;
-  int got_null = 0;
-
-  while(got_null == 0 && max > 0){
-    va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
-    n = PGSIZE - (srcva - va0);
-    if(n > max)
-      n = max;
-
-    char *p = (char *) (pa0 + (srcva - va0));
-    while(n > 0){
-      if(*p == '\0'){
-        *dst = '\0';
-        got_null = 1;
-        break;
-      } else {
-        *dst = *p;
-      }
-      --n;
-      --max;
-      p++;
-      dst++;
-    }
-
-    srcva = va0 + PGSIZE;
-  }
-  if(got_null){
-    return 0;
-  } else {
+  if(pagetable != myproc()->pagetable)
+    panic("copyinstr");
+  if(srcva >= MAXUVA)
     return -1;
-  }
+  if(max > MAXUVA - srcva)
+    max = MAXUVA - srcva;
+  return ucall(ucopystr, dst, (char*)srcva, max);
 }
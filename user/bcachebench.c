@@ -0,0 +1,114 @@
+// Buffer cache benchmark: nproc children each write a small
+// file of their own and then read it over and over, so almost
+// every read hits in the cache, and then report the time taken
+// and, for each hash bucket of the cache, how many times its
+// lock was taken and how many of those found it held. Run it
+// with make CPUS=n; with one lock per bucket, the contention
+// should stay low as CPUs are added.
+//
+// usage: bcachebench [nproc [blocks [rounds]]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+#include "kernel/bcachestat.h"
+#include "user/user.h"
+
+#define MAXPROC 16
+
+int
+main(int argc, char *argv[])
+{
+  struct bcachestat before, after;
+  char path[] = "bcachebench.0";
+  char buf[BSIZE];
+  int nproc, nblock, rounds;
+  int fd, i, j, r, pid, t0, t, xstatus, failed = 0;
+  uint64 nacquire, ncontended, total = 0, totalcontended = 0;
+
+  nproc = argc > 1 ? atoi(argv[1]) : 4;
+  nblock = argc > 2 ? atoi(argv[2]) : 4;
+  rounds = argc > 3 ? atoi(argv[3]) : 200;
+  if(nproc < 1 || nproc > MAXPROC || nblock < 1){
+    fprintf(2, "usage: bcachebench [nproc [blocks [rounds]]], nproc at most %d\n", MAXPROC);
+    exit(1);
+  }
+
+  for(i = 0; i < nproc; i++){
+    path[sizeof(path)-2] = 'a' + i;
+    if((fd = open(path, O_CREATE|O_RDWR)) < 0){
+      fprintf(2, "bcachebench: cannot create %s\n", path);
+      exit(1);
+    }
+    memset(buf, 'a' + i, sizeof(buf));
+    for(j = 0; j < nblock; j++){
+      if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+        fprintf(2, "bcachebench: write %s failed\n", path);
+        exit(1);
+      }
+    }
+    close(fd);
+  }
+
+  if(bcachestat(&before) < 0){
+    fprintf(2, "bcachebench: bcachestat failed\n");
+    exit(1);
+  }
+  t0 = uptime();
+  for(i = 0; i < nproc; i++){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "bcachebench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      path[sizeof(path)-2] = 'a' + i;
+      for(r = 0; r < rounds; r++){
+        if((fd = open(path, O_RDONLY)) < 0)
+          exit(1);
+        for(j = 0; j < nblock; j++){
+          if(read(fd, buf, sizeof(buf)) != sizeof(buf) || buf[0] != 'a' + i)
+            exit(1);
+        }
+        close(fd);
+      }
+      exit(0);
+    }
+  }
+  for(i = 0; i < nproc; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      failed = 1;
+  }
+  t = uptime() - t0;
+  bcachestat(&after);
+
+  for(i = 0; i < nproc; i++){
+    path[sizeof(path)-2] = 'a' + i;
+    unlink(path);
+  }
+  if(failed){
+    fprintf(2, "bcachebench: a reader failed\n");
+    exit(1);
+  }
+
+  printf("bcachebench: %d procs read %d blocks %d times in %d ticks\n",
+         nproc, nblock, rounds, t);
+  printf("bucket  acquired  contended\n");
+  for(i = 0; i < NBUCKET; i++){
+    nacquire = after.nacquire[i] - before.nacquire[i];
+    ncontended = after.ncontended[i] - before.ncontended[i];
+    total += nacquire;
+    totalcontended += ncontended;
+    printf("%d\t%l\t  %l\n", i, nacquire, ncontended);
+  }
+  printf("total\t%l\t  %l\n", total, totalcontended);
+  printf("hits: %l, misses: %l, %l of which waited for another\n",
+         after.nhit - before.nhit, after.nmiss - before.nmiss,
+         after.nevictcontended - before.nevictcontended);
+  printf("evictions: %l; cache now %l buffers\n",
+         after.nevict - before.nevict, after.nbuf);
+  exit(0);
+}
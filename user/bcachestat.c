@@ -0,0 +1,30 @@
+// Print the buffer cache's size and hit rate, to help
+// choose BCACHEMAX.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/fs.h"
+#include "kernel/bcachestat.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct bcachestat st;
+  uint64 n;
+
+  if(bcachestat(&st) < 0){
+    fprintf(2, "bcachestat: bcachestat failed\n");
+    exit(1);
+  }
+
+  n = st.nhit + st.nmiss;
+  printf("buffers: %l of at most %l (%l KB)\n",
+         st.nbuf, st.maxbuf, st.nbuf * BSIZE / 1024);
+  printf("lookups: %l, hits %l, misses %l, hit rate %l%%\n",
+         n, st.nhit, st.nmiss, n ? st.nhit * 100 / n : 0);
+  printf("hot buffers: %l\n", st.nhot);
+  printf("blocks read ahead: %l\n", st.nreadahead);
+  printf("evictions: %l\n", st.nevict);
+  exit(0);
+}
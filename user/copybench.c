@@ -0,0 +1,91 @@
+// Measure how fast the kernel copies to and from user
+// memory: read() a cached 64 KB file, and write() and
+// read() 64 KB at a time through a pipe, ROUNDS times
+// each, and report KB per tick.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define SZ      (64*1024)
+#define ROUNDS  200
+
+char buf[SZ];
+
+static void
+report(char *what, int t)
+{
+  if(t == 0)
+    t = 1;
+  printf("copybench: %s: %d KB in %d ticks, %d KB/tick\n",
+         what, ROUNDS * (SZ/1024), t, ROUNDS * (SZ/1024) / t);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, n, pid, fds[2], t0;
+
+  fd = open("copybench.tmp", O_CREATE|O_RDWR);
+  if(fd < 0){
+    fprintf(2, "copybench: cannot create copybench.tmp\n");
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++)
+    buf[i] = i;
+  if(write(fd, buf, SZ) != SZ){
+    fprintf(2, "copybench: write failed\n");
+    exit(1);
+  }
+  close(fd);
+
+  // the file's blocks are in the buffer cache after the
+  // first round, so this is mostly copyout().
+  t0 = uptime();
+  for(i = 0; i < ROUNDS; i++){
+    if((fd = open("copybench.tmp", O_RDONLY)) < 0)
+      exit(1);
+    if(read(fd, buf, SZ) != SZ){
+      fprintf(2, "copybench: read failed\n");
+      exit(1);
+    }
+    close(fd);
+  }
+  report("file read", uptime() - t0);
+  unlink("copybench.tmp");
+
+  // copyin() by the writer, copyout() by the reader.
+  if(pipe(fds) < 0){
+    fprintf(2, "copybench: pipe failed\n");
+    exit(1);
+  }
+  t0 = uptime();
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "copybench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(i = 0; i < ROUNDS; i++){
+      if(write(fds[1], buf, SZ) != SZ){
+        fprintf(2, "copybench: pipe write failed\n");
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  for(i = 0; i < ROUNDS * SZ; i += n){
+    if((n = read(fds[0], buf, SZ)) <= 0){
+      fprintf(2, "copybench: pipe read failed\n");
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  wait(0);
+  report("pipe", uptime() - t0);
+
+  exit(0);
+}
@@ -4,17 +4,50 @@
 
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/fcntl.h"
 #include "user/user.h"
 
 char buf[1024];
 int match(char*, char*);
 
+// a line ends at a newline as well as at a NUL, so that lines
+// can be matched in place in a mapped file.
+#define EOL(c) ((c) == '\0' || (c) == '\n')
+
+//search a regular file by mapping it, instead of copying it into buf.
+//returns 0 if the file can't be mapped, so the caller should read() it
+int
+grepmapped(char *pattern, int fd)
+{
+  struct stat st;
+  char *a, *p, *q, *end;
+
+  if(fstat(fd, &st) < 0 || st.type != T_FILE || st.size == 0)
+    return 0;
+  if((a = mmap(0, st.size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    return 0;
+  end = a + st.size;
+  for(p = a; p < end; p = q+1){
+    for(q = p; q < end && *q != '\n'; q++)  //find the end of the line
+      ;
+    if(q == end)  //like the read() path, ignore an unterminated last line
+      break;
+    if(match(pattern, p))
+      write(1, p, q+1 - p);
+  }
+  munmap(a, st.size);
+  return 1;
+}
+
 void
 grep(char *pattern, int fd)
 {
   int n, m; //n: number of bytes read, m: number of valid bytes in the buffer
   char *p, *q;
 
+  if(grepmapped(pattern, fd))
+    return;
+
   m = 0;
   while((n = read(fd, buf+m, sizeof(buf)-m-1)) > 0){
     m += n;
@@ -77,7 +110,7 @@ match(char *re, char *text)
   do{  // must look at empty string
     if(matchhere(re, text))
       return 1;
-  }while(*text++ != '\0');
+  }while(!EOL(*text++));
   return 0;
 }
 
@@ -89,8 +122,8 @@ int matchhere(char *re, char *text)
   if(re[1] == '*')
     return matchstar(re[0], re+2, text);
   if(re[0] == '$' && re[1] == '\0')
-    return *text == '\0';
-  if(*text!='\0' && (re[0]=='.' || re[0]==*text))
+    return EOL(*text);
+  if(!EOL(*text) && (re[0]=='.' || re[0]==*text))
     return matchhere(re+1, text+1);
   return 0;
 }
@@ -101,7 +134,7 @@ int matchstar(int c, char *re, char *text)
   do{  // a * matches zero or more instances
     if(matchhere(re, text))
       return 1;
-  }while(*text!='\0' && (*text++==c || c=='.'));
+  }while(!EOL(*text) && (*text++==c || c=='.'));
   return 0;
 }
 
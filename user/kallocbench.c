@@ -0,0 +1,76 @@
+// Measure how kalloc()/kfree() throughput scales with the
+// number of CPUs. Runs nproc children in parallel; each one
+// repeatedly grows its heap by NPAGE pages, touches them, and
+// shrinks it again, so every round allocates and frees NPAGE
+// physical pages. Compare the reported rates for a fixed
+// nproc under make CPUS=1 ... CPUS=8.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define NPAGE   64
+#define ROUNDS  200
+
+void
+churn(void)
+{
+  char *a;
+  int i, j;
+
+  for(i = 0; i < ROUNDS; i++){
+    a = sbrk(NPAGE*PGSIZE);
+    if(a == (char*)-1){
+      printf("kallocbench: sbrk failed\n");
+      exit(1);
+    }
+    for(j = 0; j < NPAGE; j++)
+      a[j*PGSIZE] = j;
+    sbrk(-NPAGE*PGSIZE);
+  }
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nproc, i, pid, xstatus, fail, t0, t1;
+
+  nproc = 4;
+  if(argc > 1)
+    nproc = atoi(argv[1]);
+  if(nproc < 1){
+    fprintf(2, "usage: kallocbench [nproc]\n");
+    exit(1);
+  }
+
+  t0 = uptime();
+  for(i = 0; i < nproc; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("kallocbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      churn();
+  }
+  fail = 0;
+  for(i = 0; i < nproc; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      fail = 1;
+  }
+  t1 = uptime();
+
+  if(fail){
+    printf("kallocbench: FAILED\n");
+    exit(1);
+  }
+  printf("kallocbench: %d procs, %d page allocs+frees in %d ticks",
+         nproc, nproc * ROUNDS * NPAGE, t1 - t0);
+  if(t1 > t0)
+    printf(", %d pages/tick", nproc * ROUNDS * NPAGE / (t1 - t0));
+  printf("\n");
+  exit(0);
+}
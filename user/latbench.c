@@ -0,0 +1,97 @@
+// Shell latency under load: start N compute-bound processes,
+// then time ROUNDS "echo x" commands sent to sh through a pipe,
+// each until its output comes back.
+//
+// usage: latbench [nhogs]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define ROUNDS  20
+#define MAXHOGS 16
+
+int
+main(int argc, char *argv[])
+{
+  int nhogs, i, n, t0, t, sawx;
+  int hogs[MAXHOGS], in[2], out[2], pid;
+  char *shargv[] = { "sh", 0 };
+  char c;
+
+  nhogs = argc > 1 ? atoi(argv[1]) : 4;
+  if(nhogs > MAXHOGS)
+    nhogs = MAXHOGS;
+
+  for(i = 0; i < nhogs; i++){
+    if((hogs[i] = fork()) < 0){
+      fprintf(2, "latbench: fork failed\n");
+      exit(1);
+    }
+    if(hogs[i] == 0){
+      volatile uint64 x = 0;
+      for(;;)
+        x++;
+    }
+  }
+
+  if(pipe(in) < 0 || pipe(out) < 0){
+    fprintf(2, "latbench: pipe failed\n");
+    exit(1);
+  }
+  if((pid = fork()) < 0){
+    fprintf(2, "latbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    // sh reads commands from in and writes output and
+    // prompts to out.
+    close(0);
+    dup(in[0]);
+    close(1);
+    dup(out[1]);
+    close(2);
+    dup(out[1]);
+    close(in[0]);
+    close(in[1]);
+    close(out[0]);
+    close(out[1]);
+    exec("sh", shargv);
+    exit(1);
+  }
+  close(in[0]);
+  close(out[1]);
+
+  t0 = uptime();
+  for(i = 0; i < ROUNDS; i++){
+    if(write(in[1], "echo x\n", 7) != 7){
+      fprintf(2, "latbench: write failed\n");
+      exit(1);
+    }
+    // the prompts have no x in them.
+    sawx = 0;
+    while((n = read(out[0], &c, 1)) == 1){
+      if(c == 'x')
+        sawx = 1;
+      else if(c == '\n' && sawx)
+        break;
+    }
+    if(n != 1){
+      fprintf(2, "latbench: sh went away\n");
+      exit(1);
+    }
+  }
+  t = uptime() - t0;
+
+  close(in[1]);
+  wait(0);
+  for(i = 0; i < nhogs; i++)
+    kill(hogs[i]);
+  for(i = 0; i < nhogs; i++)
+    wait(0);
+
+  // a tick is about 100ms.
+  printf("latbench: %d hogs: %d echo round trips in %d ticks, %d ms each\n",
+         nhogs, ROUNDS, t, t * 100 / ROUNDS);
+  exit(0);
+}
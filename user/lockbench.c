@@ -0,0 +1,220 @@
+// Lock benchmark for the futex-based mutexes and condition
+// variables in ulib.c, against the same thing done with pipes,
+// which always enter the kernel:
+//
+//  handoff: two threads pass a turn back and forth, with a
+//  mutex and condition variable or through a pair of pipes,
+//  and report round trips per second.
+//
+//  contention: n threads each take a lock rounds times to bump
+//  a shared counter, with a mutex or with a pipe that holds
+//  one byte as the lock's token, and report how long it takes.
+//
+// usage: lockbench [threads [rounds]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// timer interrupts per second; see TICKCYCLES in param.h.
+#define HZ 10
+
+#define STACK   4096
+#define MAXT    16
+
+int rounds;
+int nthread;
+
+struct mutex lock;
+struct cond cv;
+int turn;
+int counter;
+
+// the pipes: p[0] from the main thread to the other, and
+// p[1] back; for contention, p[0] holds the token.
+int p[2][2];
+
+void
+condping(void *arg)
+{
+  int i;
+
+  for(i = 0; i < rounds; i++){
+    mutex_lock(&lock);
+    while(turn != 1)
+      cond_wait(&cv, &lock);
+    turn = 0;
+    cond_signal(&cv);
+    mutex_unlock(&lock);
+  }
+  exit(0);
+}
+
+void
+pipeping(void *arg)
+{
+  char c;
+  int i;
+
+  for(i = 0; i < rounds; i++){
+    if(read(p[0][0], &c, 1) != 1 || write(p[1][1], &c, 1) != 1)
+      exit(1);
+  }
+  exit(0);
+}
+
+void
+mutexbump(void *arg)
+{
+  int i;
+
+  for(i = 0; i < rounds; i++){
+    mutex_lock(&lock);
+    counter++;
+    mutex_unlock(&lock);
+  }
+  exit(0);
+}
+
+void
+pipebump(void *arg)
+{
+  char c;
+  int i;
+
+  for(i = 0; i < rounds; i++){
+    if(read(p[0][0], &c, 1) != 1)
+      exit(1);
+    counter++;
+    if(write(p[0][1], &c, 1) != 1)
+      exit(1);
+  }
+  exit(0);
+}
+
+void
+start(void (*fn)(void*), int n)
+{
+  char *stack;
+  int i;
+
+  for(i = 0; i < n; i++){
+    if((stack = malloc(STACK)) == 0){
+      fprintf(2, "lockbench: out of memory\n");
+      exit(1);
+    }
+    if(clone(fn, stack + STACK, 0) < 0){
+      fprintf(2, "lockbench: clone failed\n");
+      exit(1);
+    }
+  }
+}
+
+void
+finish(int n)
+{
+  void *stack;
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(join(&stack) < 0){
+      fprintf(2, "lockbench: join failed\n");
+      exit(1);
+    }
+    free((char*)stack - STACK);
+  }
+}
+
+int
+handoff(int usepipe)
+{
+  char c = 'x';
+  int i, t0, t;
+
+  turn = 0;
+  t0 = uptime();
+  if(usepipe){
+    start(pipeping, 1);
+    for(i = 0; i < rounds; i++){
+      if(write(p[0][1], &c, 1) != 1 || read(p[1][0], &c, 1) != 1){
+        fprintf(2, "lockbench: ping-pong failed\n");
+        exit(1);
+      }
+    }
+  } else {
+    start(condping, 1);
+    for(i = 0; i < rounds; i++){
+      mutex_lock(&lock);
+      turn = 1;
+      cond_signal(&cv);
+      while(turn != 0)
+        cond_wait(&cv, &lock);
+      mutex_unlock(&lock);
+    }
+  }
+  finish(1);
+  if((t = uptime() - t0) == 0)
+    t = 1;
+  return t;
+}
+
+int
+contend(int usepipe)
+{
+  char c = 'x';
+  int t0, t;
+
+  counter = 0;
+  if(usepipe && write(p[0][1], &c, 1) != 1){
+    fprintf(2, "lockbench: write failed\n");
+    exit(1);
+  }
+  t0 = uptime();
+  start(usepipe ? pipebump : mutexbump, nthread);
+  finish(nthread);
+  if((t = uptime() - t0) == 0)
+    t = 1;
+  if(usepipe && read(p[0][0], &c, 1) != 1){
+    fprintf(2, "lockbench: lost the token\n");
+    exit(1);
+  }
+  if(counter != nthread * rounds){
+    fprintf(2, "lockbench: counter %d, expected %d\n", counter, nthread * rounds);
+    exit(1);
+  }
+  return t;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int t;
+
+  nthread = argc > 1 ? atoi(argv[1]) : 4;
+  rounds = argc > 2 ? atoi(argv[2]) : 10000;
+  if(nthread < 1 || nthread > MAXT || rounds < 1){
+    fprintf(2, "usage: lockbench [threads [rounds]], at most %d threads\n", MAXT);
+    exit(1);
+  }
+  if(pipe(p[0]) < 0 || pipe(p[1]) < 0){
+    fprintf(2, "lockbench: pipe failed\n");
+    exit(1);
+  }
+  mutex_init(&lock);
+  cond_init(&cv);
+
+  t = handoff(0);
+  printf("lockbench: handoff, mutex: %d round trips in %d ticks, %d per second\n",
+         rounds, t, rounds * HZ / t);
+  t = handoff(1);
+  printf("lockbench: handoff, pipe: %d round trips in %d ticks, %d per second\n",
+         rounds, t, rounds * HZ / t);
+
+  t = contend(0);
+  printf("lockbench: %d threads, mutex: %d ticks, %d locks per second\n",
+         nthread, t, nthread * rounds * HZ / t);
+  t = contend(1);
+  printf("lockbench: %d threads, pipe: %d ticks, %d locks per second\n",
+         nthread, t, nthread * rounds * HZ / t);
+  exit(0);
+}
@@ -0,0 +1,34 @@
+// Print free physical memory and how fragmented it is,
+// from the kernel's buddy allocator.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/memstat.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat st;
+  int k, j;
+  uint64 small;
+
+  if(memstat(&st) < 0){
+    fprintf(2, "memstat: memstat failed\n");
+    exit(1);
+  }
+
+  printf("free: %l pages (%l KB), %l in per-CPU caches, %l zeroed\n",
+         st.freepages, st.freepages * 4, st.cachedpages, st.zeroedpages);
+  printf("executable page cache: %l pages\n", st.pcachepages);
+  printf("order  size(KB)  blocks  unusable%%\n");
+  for(k = 0; k <= MAXORDER; k++){
+    // fraction of free memory that cannot satisfy an order k request.
+    small = k > 0 ? st.cachedpages + st.zeroedpages : 0;
+    for(j = 0; j < k; j++)
+      small += st.nfree[j] << j;
+    printf("%d\t%d\t  %l\t  %l\n", k, 4 << k, st.nfree[k],
+           st.freepages ? small * 100 / st.freepages : 0);
+  }
+  exit(0);
+}
@@ -0,0 +1,74 @@
+// Compare reading a file with read() against mapping it
+// with mmap(). Writes a scratch file of NKB kilobytes, then
+// scans it ROUNDS times each way, summing its bytes, and
+// reports the ticks each way took.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NKB     200
+#define ROUNDS  50
+
+char buf[4096];
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, n, t0, t1, t2;
+  uint sum1, sum2;
+  char *a;
+
+  fd = open("mmapbench.tmp", O_CREATE|O_RDWR);
+  if(fd < 0){
+    fprintf(2, "mmapbench: cannot create mmapbench.tmp\n");
+    exit(1);
+  }
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = i * 7;
+  for(i = 0; i < NKB/4; i++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      fprintf(2, "mmapbench: write failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+
+  sum1 = 0;
+  t0 = uptime();
+  for(i = 0; i < ROUNDS; i++){
+    if((fd = open("mmapbench.tmp", O_RDONLY)) < 0)
+      exit(1);
+    while((n = read(fd, buf, sizeof(buf))) > 0)
+      for(int j = 0; j < n; j++)
+        sum1 += (uchar)buf[j];
+    close(fd);
+  }
+  t1 = uptime();
+
+  sum2 = 0;
+  for(i = 0; i < ROUNDS; i++){
+    if((fd = open("mmapbench.tmp", O_RDONLY)) < 0)
+      exit(1);
+    a = mmap(0, NKB*1024, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(a == MAP_FAILED){
+      fprintf(2, "mmapbench: mmap failed\n");
+      exit(1);
+    }
+    for(int j = 0; j < NKB*1024; j++)
+      sum2 += (uchar)a[j];
+    munmap(a, NKB*1024);
+  }
+  t2 = uptime();
+
+  unlink("mmapbench.tmp");
+  if(sum1 != sum2){
+    printf("mmapbench: sums differ: %d %d\n", sum1, sum2);
+    exit(1);
+  }
+  printf("mmapbench: %d x %d KB: read() %d ticks, mmap() %d ticks\n",
+         ROUNDS, NKB, t1 - t0, t2 - t1);
+  exit(0);
+}
@@ -0,0 +1,59 @@
+// Context-switch benchmark: a parent and child bounce a
+// byte back and forth through two pipes, so that every
+// round trip takes two switches, and report round trips
+// per second.
+//
+// usage: pingbench [rounds]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// timer interrupts per second; see TICKCYCLES in param.h.
+#define HZ 10
+
+int
+main(int argc, char *argv[])
+{
+  int p2c[2], c2p[2];
+  int i, n, pid, t0, t;
+  char c = 'x';
+
+  n = argc > 1 ? atoi(argv[1]) : 20000;
+  if(pipe(p2c) < 0 || pipe(c2p) < 0){
+    fprintf(2, "pingbench: pipe failed\n");
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "pingbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(p2c[1]);
+    close(c2p[0]);
+    while(read(p2c[0], &c, 1) == 1)
+      write(c2p[1], &c, 1);
+    exit(0);
+  }
+  close(p2c[0]);
+  close(c2p[1]);
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    if(write(p2c[1], &c, 1) != 1 || read(c2p[0], &c, 1) != 1){
+      fprintf(2, "pingbench: ping-pong failed\n");
+      exit(1);
+    }
+  }
+  t = uptime() - t0;
+  close(p2c[1]);
+  wait(0);
+
+  if(t == 0)
+    t = 1;
+  printf("pingbench: %d round trips in %d ticks, %d per second\n",
+         n, t, n * HZ / t);
+  exit(0);
+}
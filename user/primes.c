@@ -1,14 +1,39 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/procstat.h"
 #include "user/user.h"
 
-void sieve(int pl[2]){
+// usage: primes [-p] [-m]
+//   -p  pin each pipeline stage to a CPU of its own, round robin
+//   -m  have each stage report how often it changed CPUs
+int pin, report;
+
+// pin the calling process to CPU stage % NCPU, or to a lower
+// one if that CPU isn't running.
+void pinstage(int stage){
+    for(int cpu = stage % NCPU; cpu >= 0; cpu--){
+        if(sched_setaffinity(getpid(), 1L << cpu) == 0)
+            return;
+    }
+}
+
+void stagedone(int stage){
+    struct procstat st;
+    if(report && procstat(&st) == 0)
+        fprintf(2, "stage %d: %d migrations\n", stage, (int)st.migrations);
+}
+
+void sieve(int pl[2], int stage){
     //pl: left pipe
     close(pl[1]);   //we will never write to the left pipe, so close it
+    if(pin)
+        pinstage(stage);
     
     int p;
     if(read(pl[0], &p, sizeof(p)) == 0) {   //if there is no more element to read
         close(pl[0]);
+        stagedone(stage);
         exit(0);
     }
     printf("prime %d\n", p);
@@ -28,21 +53,31 @@ void sieve(int pl[2]){
         close(pr[1]); //close the write end after finish all writing
         wait(0);    //wait for child
         close(pl[0]);
+        stagedone(stage);
         exit(0);
     }else{
         //child
         close(pl[0]);
-        sieve(pr);
+        sieve(pr, stage + 1);
     }
 }
 
 int
 main(int argc, char *argv[]){
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "-p") == 0)
+            pin = 1;
+        else if(strcmp(argv[i], "-m") == 0)
+            report = 1;
+    }
+
     int pf[2];  //first pipe
     pipe(pf);
 
     if(fork() != 0){
         close(pf[0]);
+        if(pin)
+            pinstage(0);
         for(int i = 2; i <= 35; i++){
             write(pf[1], &i, sizeof(i));
         }
@@ -50,7 +85,7 @@ main(int argc, char *argv[]){
         wait(0);    //wait for child
     }else{
         close(pf[1]);
-        sieve(pf);
+        sieve(pf, 1);
         exit(0);
     }
     wait(0);
@@ -0,0 +1,97 @@
+// Parallel sum benchmark for clone() and join(): sum an
+// array with 1, 2, 4, ... threads, each summing a slice of
+// it, and report how long each takes. With enough CPUs
+// (make CPUS=n qemu), the time should fall in proportion
+// to the number of threads up to the number of CPUs.
+//
+// usage: psum [maxthreads [rounds]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define N       (1024*1024)
+#define STACK   4096
+#define MAXT    16
+
+int a[N];
+int rounds;
+int nthread;
+
+// one sum per thread, a cache line apart.
+uint64 sums[MAXT][8];
+
+void
+summer(void *arg)
+{
+  int id = (int)(uint64)arg;
+  int lo = id * (N / nthread);
+  int hi = id == nthread-1 ? N : lo + N / nthread;
+  uint64 sum = 0;
+  int i, r;
+
+  for(r = 0; r < rounds; r++){
+    for(i = lo; i < hi; i++)
+      sum += a[i] ^ r;
+  }
+  sums[id][0] = sum;
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *stacks[MAXT];
+  void *stack;
+  uint64 sum, expect = 0;
+  int i, max, t0, t, t1 = 0;
+
+  max = argc > 1 ? atoi(argv[1]) : 8;
+  rounds = argc > 2 ? atoi(argv[2]) : 20;
+  if(max < 1 || max > MAXT){
+    fprintf(2, "psum: at most %d threads\n", MAXT);
+    exit(1);
+  }
+  // touch every page now, so the threads don't fault.
+  for(i = 0; i < N; i++)
+    a[i] = i;
+
+  for(nthread = 1; nthread <= max; nthread *= 2){
+    for(i = 0; i < nthread; i++){
+      if((stacks[i] = malloc(STACK)) == 0){
+        fprintf(2, "psum: out of memory\n");
+        exit(1);
+      }
+    }
+    t0 = uptime();
+    for(i = 0; i < nthread; i++){
+      if(clone(summer, stacks[i] + STACK, (void*)(uint64)i) < 0){
+        fprintf(2, "psum: clone failed\n");
+        exit(1);
+      }
+    }
+    for(i = 0; i < nthread; i++){
+      if(join(&stack) < 0){
+        fprintf(2, "psum: join failed\n");
+        exit(1);
+      }
+      free((char*)stack - STACK);
+    }
+    if((t = uptime() - t0) == 0)
+      t = 1;
+
+    sum = 0;
+    for(i = 0; i < nthread; i++)
+      sum += sums[i][0];
+    if(nthread == 1){
+      expect = sum;
+      t1 = t;
+    } else if(sum != expect){
+      fprintf(2, "psum: %d threads got the wrong sum\n", nthread);
+      exit(1);
+    }
+    printf("psum: %d threads: %d ticks, speedup %d.%d\n",
+           nthread, t, t1 / t, (t1 * 10 / t) % 10);
+  }
+  exit(0);
+}
@@ -0,0 +1,85 @@
+// Sequential read benchmark: write a file, then read it from
+// start to end with read() buffers of several sizes, and report
+// the throughput of each pass and how many blocks it had to
+// wait for (cache misses) and how many were read ahead. The file
+// has to be bigger than the buffer cache for the reads to go to
+// the disk, so boot with a small cache, e.g.
+// make BCACHEMAX=64 qemu.
+//
+// usage: readbench [kbytes]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+#include "kernel/bcachestat.h"
+#include "user/user.h"
+
+// timer interrupts per second; see TICKCYCLES in param.h.
+#define HZ 10
+
+#define FILE "readbench.f"
+
+char buf[16*1024];
+int sizes[] = { 512, 1024, 4096, 16*1024 };
+
+int
+main(int argc, char *argv[])
+{
+  struct bcachestat before, after;
+  int kbytes, fd, i, j, n, total, t0, t;
+
+  kbytes = argc > 1 ? atoi(argv[1]) : 256;
+  if(kbytes < 1 || kbytes > MAXFILE){
+    fprintf(2, "usage: readbench [kbytes], at most %d\n", MAXFILE);
+    exit(1);
+  }
+
+  if((fd = open(FILE, O_CREATE|O_WRONLY)) < 0){
+    fprintf(2, "readbench: cannot create %s\n", FILE);
+    exit(1);
+  }
+  for(i = 0; i < kbytes; i++){
+    memset(buf, i, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      fprintf(2, "readbench: write failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+
+  for(i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++){
+    if((fd = open(FILE, O_RDONLY)) < 0){
+      fprintf(2, "readbench: cannot open %s\n", FILE);
+      exit(1);
+    }
+    bcachestat(&before);
+    total = 0;
+    t0 = uptime();
+    while((n = read(fd, buf, sizes[i])) > 0){
+      // check a byte of each block.
+      for(j = 0; j < n; j += BSIZE){
+        if((uchar)buf[j] != (uchar)((total + j) / BSIZE)){
+          fprintf(2, "readbench: bad data at %d\n", total + j);
+          exit(1);
+        }
+      }
+      total += n;
+    }
+    t = uptime() - t0;
+    bcachestat(&after);
+    close(fd);
+    if(total != kbytes * BSIZE){
+      fprintf(2, "readbench: read %d bytes, expected %d\n", total, kbytes * BSIZE);
+      exit(1);
+    }
+    if(t == 0)
+      t = 1;
+    printf("readbench: %d-byte reads: %d KB in %d ticks, %d KB/s; %l misses, %l read ahead\n",
+           sizes[i], kbytes, t, kbytes * HZ / t,
+           after.nmiss - before.nmiss, after.nreadahead - before.nreadahead);
+  }
+  unlink(FILE);
+  exit(0);
+}
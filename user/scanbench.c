@@ -0,0 +1,183 @@
+// Buffer cache scan-resistance benchmark: time a find-like walk
+// of a directory tree, first on its own and then while another
+// process cats a big file over and over. Once the walk's blocks
+// (directories and inodes) are hot, the stream of file blocks
+// shouldn't push them out, so the walk should slow down little.
+// The big file has to be bigger than the cache for that to be a
+// test, so boot with a small cache, e.g. make BCACHEMAX=150 qemu.
+//
+// usage: scanbench [depth [fanout [rounds [kbytes]]]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+#include "kernel/bcachestat.h"
+#include "user/user.h"
+
+#define BIG "scanbench.big"
+#define TOP "scanbench.d"
+
+int depth, fanout;
+char buf[BSIZE];
+
+// make a tree of directories, each with one small file.
+void
+mktree(char *path, int level)
+{
+  char *p = path + strlen(path);
+  int i, fd;
+
+  strcpy(p, "/f");
+  if((fd = open(path, O_CREATE|O_WRONLY)) < 0 || write(fd, path, 32) != 32){
+    fprintf(2, "scanbench: cannot create %s\n", path);
+    exit(1);
+  }
+  close(fd);
+  if(level < depth){
+    for(i = 0; i < fanout; i++){
+      p[0] = '/';
+      p[1] = 'a' + i;
+      p[2] = 0;
+      if(mkdir(path) < 0){
+        fprintf(2, "scanbench: cannot mkdir %s\n", path);
+        exit(1);
+      }
+      mktree(path, level + 1);
+    }
+  }
+  *p = 0;
+}
+
+// visit everything under path, as find does; remove
+// it all as well if rm is set. returns the number of
+// entries seen.
+int
+walk(char *path, int rm)
+{
+  char *p = path + strlen(path);
+  struct dirent de;
+  struct stat st;
+  int fd, n = 0;
+
+  if((fd = open(path, O_RDONLY)) < 0){
+    fprintf(2, "scanbench: cannot open %s\n", path);
+    exit(1);
+  }
+  *p = '/';
+  while(read(fd, &de, sizeof(de)) == sizeof(de)){
+    if(de.inum == 0 || strcmp(de.name, ".") == 0 || strcmp(de.name, "..") == 0)
+      continue;
+    memmove(p + 1, de.name, DIRSIZ);
+    p[1 + DIRSIZ] = 0;
+    if(stat(path, &st) < 0){
+      fprintf(2, "scanbench: cannot stat %s\n", path);
+      exit(1);
+    }
+    n++;
+    if(st.type == T_DIR)
+      n += walk(path, rm);
+    if(rm)
+      unlink(path);
+  }
+  close(fd);
+  *p = 0;
+  return n;
+}
+
+// read the big file again and again, until killed.
+void
+streamer(void)
+{
+  int fd;
+
+  for(;;){
+    if((fd = open(BIG, O_RDONLY)) < 0)
+      exit(1);
+    while(read(fd, buf, sizeof(buf)) > 0)
+      ;
+    close(fd);
+  }
+}
+
+// walk the tree rounds times, and report how long it took
+// and how the cache did meanwhile.
+void
+timewalks(char *what, int rounds)
+{
+  struct bcachestat before, after;
+  char path[128];
+  int i, n = 0, t0, t;
+  uint64 hits, misses;
+
+  bcachestat(&before);
+  t0 = uptime();
+  for(i = 0; i < rounds; i++){
+    strcpy(path, TOP);
+    n = walk(path, 0);
+  }
+  t = uptime() - t0;
+  bcachestat(&after);
+
+  hits = after.nhit - before.nhit;
+  misses = after.nmiss - before.nmiss;
+  printf("scanbench: %s: %d walks of %d entries in %d ticks\n", what, rounds, n, t);
+  printf("scanbench:   cache hits %l, misses %l, hot buffers %l of %l\n",
+         hits, misses, after.nhot, after.nbuf);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char path[128];
+  int rounds, kbytes, i, fd, pid;
+
+  depth = argc > 1 ? atoi(argv[1]) : 3;
+  fanout = argc > 2 ? atoi(argv[2]) : 3;
+  rounds = argc > 3 ? atoi(argv[3]) : 20;
+  kbytes = argc > 4 ? atoi(argv[4]) : 200;
+  if(depth < 1 || fanout < 1 || fanout > 26 || rounds < 1 || kbytes < 1 || kbytes > MAXFILE){
+    fprintf(2, "usage: scanbench [depth [fanout [rounds [kbytes]]]]\n");
+    exit(1);
+  }
+
+  if(mkdir(TOP) < 0){
+    fprintf(2, "scanbench: cannot mkdir %s\n", TOP);
+    exit(1);
+  }
+  strcpy(path, TOP);
+  mktree(path, 1);
+  if((fd = open(BIG, O_CREATE|O_WRONLY)) < 0){
+    fprintf(2, "scanbench: cannot create %s\n", BIG);
+    exit(1);
+  }
+  memset(buf, 'x', sizeof(buf));
+  for(i = 0; i < kbytes; i++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      fprintf(2, "scanbench: write %s failed\n", BIG);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  // warm up, so the tree's blocks have a chance to turn hot.
+  timewalks("warm-up", 2);
+  timewalks("alone", rounds);
+
+  if((pid = fork()) < 0){
+    fprintf(2, "scanbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0)
+    streamer();
+  timewalks("with cat", rounds);
+  kill(pid);
+  wait(0);
+
+  strcpy(path, TOP);
+  walk(path, 1);
+  unlink(TOP);
+  unlink(BIG);
+  exit(0);
+}
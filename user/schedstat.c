@@ -0,0 +1,40 @@
+// Print the kernel's scheduler statistics: wakeup() work,
+// timer interrupts, IPIs, and how long each CPU has been idle.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/schedstat.h"
+#include "user/user.h"
+
+// rate of the time CSR; see timerinit() in start.c.
+#define CYCLES_PER_MS 10000
+
+int
+main(int argc, char *argv[])
+{
+  struct schedstat st;
+  int i;
+
+  if(schedstat(&st) < 0){
+    fprintf(2, "schedstat: schedstat failed\n");
+    exit(1);
+  }
+  printf("wakeup: %l calls, %l sleepers examined", st.wakeups, st.wakeupscans);
+  if(st.wakeups > 0)
+    printf(", %l.%l%l per call", st.wakeupscans / st.wakeups,
+           st.wakeupscans * 10 / st.wakeups % 10,
+           st.wakeupscans * 100 / st.wakeups % 10);
+  printf(", %l processes woken\n", st.woken);
+
+  printf("timer: %l interrupts\n", st.timerintrs);
+  printf("ipi: %l sent to idle cpus\n", st.ipis);
+  // CPUs that never waited (or never started) are left out.
+  for(i = 0; i < NCPU; i++){
+    if(st.idle[i] == 0)
+      continue;
+    printf("cpu %d: idle %l ms of %l, %l%%\n", i,
+           st.idle[i] / CYCLES_PER_MS, st.time / CYCLES_PER_MS,
+           st.idle[i] * 100 / st.time);
+  }
+  exit(0);
+}
@@ -0,0 +1,63 @@
+// Measure the cost of sleeping processes: start NSLEEP
+// children that each sleep() for a long time, and report
+// how many wakeups and timer interrupts there are per
+// second while they sleep.
+//
+// usage: sleepbench [seconds]
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "kernel/schedstat.h"
+#include "user/user.h"
+
+#define NSLEEP 50
+
+// timer interrupts per second; see TICKCYCLES in param.h.
+#define HZ 10
+
+int pids[NSLEEP];
+
+int
+main(int argc, char *argv[])
+{
+  struct schedstat st0, st1;
+  int i, n, secs, t0, t;
+
+  secs = argc > 1 ? atoi(argv[1]) : 5;
+  for(n = 0; n < NSLEEP; n++){
+    if((pids[n] = fork()) < 0){
+      fprintf(2, "sleepbench: fork failed\n");
+      break;
+    }
+    if(pids[n] == 0){
+      for(;;)
+        sleep(1000000);
+    }
+  }
+  // let the children get to sleep.
+  sleep(HZ);
+
+  t0 = uptime();
+  if(schedstat(&st0) < 0){
+    fprintf(2, "sleepbench: schedstat failed\n");
+    exit(1);
+  }
+  sleep(secs * HZ);
+  if(schedstat(&st1) < 0){
+    fprintf(2, "sleepbench: schedstat failed\n");
+    exit(1);
+  }
+  t = uptime() - t0;
+
+  for(i = 0; i < n; i++)
+    kill(pids[i]);
+  for(i = 0; i < n; i++)
+    wait(0);
+
+  if(t == 0)
+    t = 1;
+  printf("sleepbench: %d sleeping, %d ticks: %l wakeups/s, %l timer interrupts/s\n",
+         n, t, (st1.woken - st0.woken) * HZ / t,
+         (st1.timerintrs - st0.timerintrs) * HZ / t);
+  exit(0);
+}
@@ -151,3 +151,79 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// Mutexes that don't enter the kernel unless contended.
+// m->v is 0 when unlocked, 1 when locked, and 2 when locked
+// and some thread may be asleep in futex_wait() on it, in
+// which case mutex_unlock() has to wake one.
+void
+mutex_init(struct mutex *m)
+{
+  m->v = 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->v, 0, 1)) == 0)
+    return;
+  // contended: say so, and sleep until the holder lets go.
+  if(c != 2)
+    c = __sync_lock_test_and_set(&m->v, 2);
+  while(c != 0){
+    futex_wait(&m->v, 2);
+    c = __sync_lock_test_and_set(&m->v, 2);
+  }
+}
+
+// returns 1 if m was acquired, 0 if it is held.
+int
+mutex_trylock(struct mutex *m)
+{
+  return __sync_val_compare_and_swap(&m->v, 0, 1) == 0;
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__sync_fetch_and_sub(&m->v, 1) != 1){
+    __sync_lock_release(&m->v);
+    futex_wake(&m->v, 1);
+  }
+}
+
+// Condition variables. A waiter sleeps until c->seq moves on
+// from the value it saw while holding the mutex, so a signal
+// between mutex_unlock() and futex_wait() isn't lost. As with
+// any condition variable, callers recheck their condition.
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+}
+
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  int seq = c->seq;
+
+  mutex_unlock(m);
+  futex_wait(&c->seq, seq);
+  mutex_lock(m);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 0x7fffffff);
+}
@@ -1,5 +1,9 @@
 struct stat;
 struct rtcdate;
+struct memstat;
+struct procstat;
+struct schedstat;
+struct bcachestat;
 
 // system calls
 int fork(void);
@@ -23,6 +27,19 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int memstat(struct memstat*);
+int procstat(struct procstat*);
+void *mmap(void*, uint, int, int, int, uint);
+int munmap(void*, uint);
+int schedstat(struct schedstat*);
+int setpriority(int, int);
+int getpriority(int);
+int sched_setaffinity(int, uint64);
+int clone(void (*)(void*), void*, void*);
+int join(void**);
+int futex_wait(int*, int);
+int futex_wake(int*, int);
+int bcachestat(struct bcachestat*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -40,3 +57,19 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+
+// ulib.c: locks for clone()d threads, built on futexes.
+struct mutex {
+  int v;     // 0 unlocked, 1 locked, 2 locked and maybe waited for
+};
+struct cond {
+  int seq;   // bumped by each signal
+};
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+int mutex_trylock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
@@ -7,6 +7,8 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/memstat.h"
+#include "kernel/procstat.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -2046,7 +2048,8 @@ iref(char *s)
 void
 forktest(char *s)
 {
-  enum{ N = 1000 };
+  // fork() must run out of procs or memory by NPROC.
+  enum{ N = NPROC };
   int n, pid;
 
   for(n=0; n<N; n++){
@@ -2063,7 +2066,7 @@ forktest(char *s)
   }
 
   if(n == N){
-    printf("%s: fork claimed to work 1000 times!\n", s);
+    printf("%s: fork claimed to work %d times!\n", s, N);
     exit(1);
   }
 
@@ -2080,6 +2083,405 @@ forktest(char *s)
   }
 }
 
+// keep 1000 processes alive at once, more than fit in a
+// fixed-size process table, then let them all go.
+void
+manyprocs(char *s)
+{
+  enum{ N = 1000 };
+  int fds[2], i, n, pid;
+  char c;
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  for(n = 0; n < N; n++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork %d failed\n", s, n);
+      break;
+    }
+    if(pid == 0){
+      // wait for the parent to close the write end.
+      close(fds[1]);
+      read(fds[0], &c, 1);
+      exit(0);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+  for(i = 0; i < n; i++){
+    if(wait(0) < 0){
+      printf("%s: wait stopped early\n", s);
+      exit(1);
+    }
+  }
+  if(n < N)
+    exit(1);
+}
+
+// for threads: the write end of a pipe, and each
+// thread's page from sbrk().
+int threadfd;
+char *threadmem[4];
+
+void
+threadfn(void *arg)
+{
+  int i = (int)(uint64)arg;
+  char *p;
+
+  // threads calling sbrk() at once must get separate memory.
+  if((p = sbrk(4096)) == (char*)-1)
+    exit(1);
+  p[0] = 'a' + i;
+  threadmem[i] = p;
+  // the descriptor was opened by the creating thread.
+  write(threadfd, p, 1);
+  exit(0);
+}
+
+// threads made by clone() share memory and open files, and
+// join() reaps them, handing back their stacks.
+void
+threads(char *s)
+{
+  enum { N = 4 };
+  char *stacks[N], c;
+  void *stack;
+  int fds[2], i, j, seen = 0;
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  threadfd = fds[1];
+  for(i = 0; i < N; i++){
+    if((stacks[i] = malloc(4096)) == 0){
+      printf("%s: malloc failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    if(clone(threadfn, stacks[i] + 4096, (void*)(uint64)i) < 0){
+      printf("%s: clone failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    if(read(fds[0], &c, 1) != 1 || c < 'a' || c >= 'a' + N){
+      printf("%s: bad read from thread\n", s);
+      exit(1);
+    }
+    seen |= 1 << (c - 'a');
+  }
+  for(i = 0; i < N; i++){
+    if(join(&stack) < 0){
+      printf("%s: join failed\n", s);
+      exit(1);
+    }
+    for(j = 0; j < N; j++){
+      if(stack == stacks[j] + 4096)
+        break;
+    }
+    if(j == N){
+      printf("%s: join returned a bad stack\n", s);
+      exit(1);
+    }
+  }
+  if(join(&stack) != -1 || wait(0) != -1){
+    printf("%s: reaped too many\n", s);
+    exit(1);
+  }
+  if(seen != (1 << N) - 1){
+    printf("%s: threads missing\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if(threadmem[i][0] != 'a' + i){
+      printf("%s: threads' sbrk() memory overlaps\n", s);
+      exit(1);
+    }
+  }
+}
+
+// for forkthreads: set to stop the threads.
+volatile int forkstop;
+
+void
+forkthreadfn(void *arg)
+{
+  char *p;
+
+  while(!forkstop){
+    if((p = sbrk(4096)) == (char*)-1)
+      exit(1);
+    p[0] = 1;
+    p[4095] = 2;
+    sbrk(-4096);
+  }
+  exit(0);
+}
+
+// fork() while other threads of the process are running
+// and changing its memory.
+void
+forkthreads(char *s)
+{
+  enum { N = 3, NFORK = 20 };
+  char *stacks[N];
+  void *stack;
+  int i, pid, xstatus;
+
+  forkstop = 0;
+  for(i = 0; i < N; i++){
+    if((stacks[i] = malloc(4096)) == 0){
+      printf("%s: malloc failed\n", s);
+      exit(1);
+    }
+    if(clone(forkthreadfn, stacks[i] + 4096, 0) < 0){
+      printf("%s: clone failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < NFORK; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      // the child has only this thread.
+      if(join(&stack) != -1)
+        exit(1);
+      exit(0);
+    }
+    if(wait(&xstatus) != pid || xstatus != 0){
+      printf("%s: forked child failed\n", s);
+      exit(1);
+    }
+  }
+  forkstop = 1;
+  for(i = 0; i < N; i++){
+    if(join(&stack) < 0){
+      printf("%s: join failed\n", s);
+      exit(1);
+    }
+    free((char*)stack - 4096);
+  }
+}
+
+// for threadexit: the write end of a pipe that the
+// thread fills.
+int exitfd;
+
+void
+exitthreadfn(void *arg)
+{
+  for(;;){
+    if(write(exitfd, "x", 1) != 1)
+      exit(1);
+  }
+}
+
+// when a process's first thread exits, or is killed, its
+// other threads end too, before wait() returns.
+void
+threadexit(char *s)
+{
+  char *stack, buf[64];
+  int fds[2], kills, pid, n, total, xstatus;
+
+  for(kills = 0; kills < 2; kills++){
+    if(pipe(fds) < 0){
+      printf("%s: pipe failed\n", s);
+      exit(1);
+    }
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[0]);
+      exitfd = fds[1];
+      if((stack = malloc(4096)) == 0 ||
+         clone(exitthreadfn, stack + 4096, 0) < 0)
+        exit(1);
+      if(kills)
+        for(;;)
+          sleep(100);
+      sleep(1);
+      exit(0);
+    }
+    close(fds[1]);
+    if(kills){
+      sleep(2);
+      kill(pid);
+    }
+    if(wait(&xstatus) != pid || xstatus != (kills ? -1 : 0)){
+      printf("%s: child failed\n", s);
+      exit(1);
+    }
+    // the thread is gone, so only what's in the
+    // pipe is left to read.
+    total = 0;
+    while((n = read(fds[0], buf, sizeof(buf))) > 0){
+      total += n;
+      if(total > 10000){
+        printf("%s: thread outlived its process\n", s);
+        exit(1);
+      }
+    }
+    close(fds[0]);
+  }
+}
+
+// for mutexes: a counter that threads bump under lock,
+// and a turn that they pass around with cv.
+struct mutex lock;
+struct cond cv;
+int counter, turn;
+
+void
+mutexfn(void *arg)
+{
+  int id = (int)(uint64)arg;
+  int i;
+
+  for(i = 0; i < 1000; i++){
+    mutex_lock(&lock);
+    counter++;
+    mutex_unlock(&lock);
+  }
+  // then take turns in order of id.
+  mutex_lock(&lock);
+  while(turn != id)
+    cond_wait(&cv, &lock);
+  turn++;
+  cond_broadcast(&cv);
+  mutex_unlock(&lock);
+  exit(0);
+}
+
+// the futex-based mutexes and condition variables in ulib.c.
+void
+mutexes(char *s)
+{
+  enum { N = 4 };
+  char *stacks[N];
+  void *stack;
+  int i, v = 1;
+
+  // a futex_wait() on a word that has changed returns at once.
+  if(futex_wait(&v, 0) != -1){
+    printf("%s: futex_wait slept on a changed word\n", s);
+    exit(1);
+  }
+  if(futex_wake(&v, 1) != 0){
+    printf("%s: futex_wake woke a thread that wasn't waiting\n", s);
+    exit(1);
+  }
+  if(futex_wait((int*)(MAXVA+4096), 0) != -1){
+    printf("%s: futex_wait accepted a bad address\n", s);
+    exit(1);
+  }
+  mutex_init(&lock);
+  cond_init(&cv);
+  counter = turn = 0;
+  for(i = 0; i < N; i++){
+    if((stacks[i] = malloc(4096)) == 0){
+      printf("%s: malloc failed\n", s);
+      exit(1);
+    }
+    if(clone(mutexfn, stacks[i] + 4096, (void*)(uint64)i) < 0){
+      printf("%s: clone failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    if(join(&stack) < 0){
+      printf("%s: join failed\n", s);
+      exit(1);
+    }
+    free((char*)stack - 4096);
+  }
+  if(counter != N*1000 || turn != N){
+    printf("%s: counter %d turn %d\n", s, counter, turn);
+    exit(1);
+  }
+}
+
+// for forkfutex: the word a thread waits on, and
+// whether it has been woken.
+int futexword;
+volatile int futexwoken;
+
+void
+futexwaitfn(void *arg)
+{
+  while(futexword == 0)
+    futex_wait(&futexword, 0);
+  futexwoken = 1;
+  exit(0);
+}
+
+// a futex_wake() reaches a thread that started waiting before
+// a fork(), even though fork() made the word's page copy-on-
+// write, so that the write before the wake moves the word to
+// another physical page.
+void
+forkfutex(char *s)
+{
+  char *stack, c = 0;
+  void *st;
+  int i, pid, fds[2], xstatus;
+
+  futexword = futexwoken = 0;
+  if((stack = malloc(4096)) == 0){
+    printf("%s: malloc failed\n", s);
+    exit(1);
+  }
+  if(clone(futexwaitfn, stack + 4096, 0) < 0){
+    printf("%s: clone failed\n", s);
+    exit(1);
+  }
+  // give the thread time to start waiting.
+  sleep(2);
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // keep the page shared until the parent has written it.
+    read(fds[0], &c, 1);
+    exit(0);
+  }
+  futexword = 1;
+  futex_wake(&futexword, 1);
+  for(i = 0; i < 50 && !futexwoken; i++)
+    sleep(1);
+  write(fds[1], &c, 1);
+  close(fds[0]);
+  close(fds[1]);
+  wait(&xstatus);
+  if(!futexwoken){
+    printf("%s: futex_wake after fork didn't reach the waiter\n", s);
+    exit(1);
+  }
+  if(join(&st) < 0){
+    printf("%s: join failed\n", s);
+    exit(1);
+  }
+  free((char*)st - 4096);
+}
+
 void
 sbrkbasic(char *s)
 {
@@ -2508,6 +2910,27 @@ stacktest(char *s)
     exit(xstatus);
 }
 
+// the kernel copies to user memory in supervisor mode, which
+// could write pages without PTE_U, such as the stack guard page.
+// read() into the guard page must fail instead.
+void
+copyguard(char *s)
+{
+  int fd;
+  char *guard = (char *) (PGROUNDDOWN(r_sp()) - PGSIZE);
+
+  fd = open("init", O_RDONLY);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  if(read(fd, guard, 16) != -1){
+    printf("%s: read into the stack guard page succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+}
+
 // regression test. copyin(), copyout(), and copyinstr() used to cast
 // the virtual page address to uint, which (with certain wild system
 // call arguments) resulted in a kernel page faults.
@@ -2617,6 +3040,353 @@ sbrk8000(char *s)
   *(top-1) = *(top-1) + 1;
 }
 
+// does memstat() account for every free page, and do
+// allocations and frees show up in it?
+void
+memstattest(char *s)
+{
+  enum { N=64 };
+  struct memstat st0, st1, st2;
+  uint64 sum;
+  char *a;
+  int i;
+
+  if(memstat(&st0) < 0){
+    printf("%s: memstat failed\n", s);
+    exit(1);
+  }
+  sum = st0.cachedpages + st0.zeroedpages;
+  for(i = 0; i <= MAXORDER; i++)
+    sum += st0.nfree[i] << i;
+  if(sum != st0.freepages){
+    printf("%s: free blocks add up to %d pages, not %d\n", s, (int)sum, (int)st0.freepages);
+    exit(1);
+  }
+
+  a = sbrk(N*PGSIZE);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    a[i*PGSIZE] = i;
+  memstat(&st1);
+  if(st1.freepages + N > st0.freepages){
+    printf("%s: %d pages allocated, free count only fell by %d\n", s,
+           N, (int)(st0.freepages - st1.freepages));
+    exit(1);
+  }
+
+  sbrk(-N*PGSIZE);
+  memstat(&st2);
+  if(st2.freepages < st1.freepages + N){
+    printf("%s: %d pages freed, free count only rose by %d\n", s,
+           N, (int)(st2.freepages - st1.freepages));
+    exit(1);
+  }
+}
+
+// sbrk() should not allocate memory until the pages are touched,
+// and each first touch should cost exactly one page fault.
+// (N is small enough that no whole superpage fits.)
+void
+lazysbrk(char *s)
+{
+  enum { N=256 };
+  struct procstat st0, st1, st2;
+  char *a;
+
+  // start on a fresh page.
+  a = sbrk(0);
+  if((uint64)a % PGSIZE)
+    sbrk(PGSIZE - (uint64)a % PGSIZE);
+
+  procstat(&st0);
+  a = sbrk(N*PGSIZE);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  procstat(&st1);
+  if(st1.sz != st0.sz + N*PGSIZE || st1.resident > st0.resident + 1){
+    printf("%s: sbrk allocated %d pages up front\n", s, (int)(st1.resident - st0.resident));
+    exit(1);
+  }
+
+  a[0] = 1;
+  a[N/2*PGSIZE] = 2;
+  if(a[(N-1)*PGSIZE] != 0){
+    printf("%s: untouched page not zero\n", s);
+    exit(1);
+  }
+  procstat(&st2);
+  if(st2.pagefaults - st1.pagefaults != 3 || st2.resident - st1.resident != 3){
+    printf("%s: 3 touches, %d faults, %d new pages\n", s,
+           (int)(st2.pagefaults - st1.pagefaults), (int)(st2.resident - st1.resident));
+    exit(1);
+  }
+  sbrk(-N*PGSIZE);
+}
+
+// a large, aligned heap region gets superpages, which
+// fork() and a partial sbrk(-n) split up correctly.
+void
+superpage(char *s)
+{
+  struct procstat st;
+  uint64 top, base;
+  char *a;
+  int i, pid, xstatus;
+
+  top = (uint64)sbrk(0);
+  base = (top + SUPERPGSIZE - 1) & ~(SUPERPGSIZE - 1);
+  if(sbrk(base + 2*SUPERPGSIZE - top) == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  a = (char*)base;
+  for(i = 0; i < 2*SUPERPGSIZE; i += PGSIZE)
+    a[i] = i / PGSIZE;
+  procstat(&st);
+  if(st.superpages != 2){
+    printf("%s: %d superpages, expected 2\n", s, (int)st.superpages);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < 2*SUPERPGSIZE; i += PGSIZE)
+      if(a[i] != (char)(i / PGSIZE))
+        exit(1);
+    a[0] = 99;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || a[0] != 0){
+    printf("%s: child saw wrong data, or parent saw child's write\n", s);
+    exit(1);
+  }
+
+  // cut the last page off; the rest must survive.
+  sbrk(-PGSIZE);
+  for(i = 0; i < 2*SUPERPGSIZE - PGSIZE; i += PGSIZE){
+    if(a[i] != (char)(i / PGSIZE)){
+      printf("%s: page %d lost its contents\n", s, i / PGSIZE);
+      exit(1);
+    }
+  }
+  sbrk(-(2*SUPERPGSIZE - PGSIZE));
+}
+
+// setpriority() and getpriority(), and a compute-bound
+// process should move down from the top priority.
+void
+priotest(char *s)
+{
+  int pid = getpid();
+  int child, xstatus, t0;
+
+  if(setpriority(pid, -1) != -1 || setpriority(pid, 100) != -1){
+    printf("%s: setpriority accepted a bad priority\n", s);
+    exit(1);
+  }
+  if(setpriority(pid, 1) != 0 || getpriority(pid) != 1){
+    printf("%s: setpriority(1) didn't take\n", s);
+    exit(1);
+  }
+  if(setpriority(pid, 0) != 0){
+    printf("%s: setpriority(0) failed\n", s);
+    exit(1);
+  }
+
+  child = fork();
+  if(child < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(child == 0){
+    t0 = uptime();
+    while(getpriority(getpid()) == 0){
+      if(uptime() - t0 > 100)
+        exit(1);
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: compute-bound process kept the top priority\n", s);
+    exit(1);
+  }
+}
+
+// kill() finds a process by pid, but not one that has been
+// reaped, even after its proc slot is reused.
+void
+killpid(char *s)
+{
+  int pid, pid2, xstatus;
+
+  if(kill(0) != -1 || kill(-1) != -1){
+    printf("%s: kill of a bad pid succeeded\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(0);
+  wait(0);
+
+  pid2 = fork();
+  if(pid2 < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid2 == 0){
+    for(;;)
+      sleep(1000);
+  }
+  if(kill(pid) != -1){
+    printf("%s: kill of a reaped pid succeeded\n", s);
+    exit(1);
+  }
+  if(kill(pid2) != 0){
+    printf("%s: kill of a live pid failed\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: killed child exited with %d\n", s, xstatus);
+    exit(1);
+  }
+}
+
+// mmap() of files and anonymous memory.
+void
+mmaptest(char *s)
+{
+  enum { N=3*PGSIZE+100 };
+  char *a, *b;
+  int fd, i, pid, xstatus;
+
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++)
+    if(write(fd, "abcdefghij" + i%10, 1) != 1){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+
+  // private mapping: sees the file, beyond EOF is zero,
+  // and writes stay private.
+  a = mmap(0, N, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(a == MAP_FAILED){
+    printf("%s: mmap private failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if(a[i] != 'a' + i%10){
+      printf("%s: wrong byte %d in private mapping\n", s, i);
+      exit(1);
+    }
+  }
+  if(a[N] != 0){
+    printf("%s: no zero past end of file\n", s);
+    exit(1);
+  }
+  a[0] = 'X';
+  if(munmap(a, N) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+
+  // shared mapping: a write shows up in the file after munmap.
+  a = mmap(0, N, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(a == MAP_FAILED || a[0] != 'a'){
+    printf("%s: mmap shared failed or saw private write\n", s);
+    exit(1);
+  }
+  a[PGSIZE] = 'Y';
+  if(munmap(a, N) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  char c;
+  if(read(fd, &c, 1) != 0 || close(fd) < 0 || (fd = open("mmapfile", O_RDONLY)) < 0){
+    printf("%s: reopen failed\n", s);
+    exit(1);
+  }
+  struct stat st;
+  if(fstat(fd, &st) < 0 || st.size != N){
+    printf("%s: munmap changed the file size\n", s);
+    exit(1);
+  }
+  for(i = 0; i <= PGSIZE; i++){
+    if(read(fd, &c, 1) != 1 || c != (i == PGSIZE ? 'Y' : 'a' + i%10)){
+      printf("%s: byte %d of file wrong after munmap\n", s, i);
+      exit(1);
+    }
+  }
+
+  // a shared write mapping needs a writable file.
+  if(mmap(0, N, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0) != MAP_FAILED){
+    printf("%s: shared writable mapping of read-only file\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmapfile");
+
+  // anonymous shared memory is shared with a child.
+  a = mmap(0, 2*PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  b = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(a == MAP_FAILED || b == MAP_FAILED || a[0] != 0){
+    printf("%s: anonymous mmap failed\n", s);
+    exit(1);
+  }
+  a[0] = 1;
+  b[0] = 1;
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    a[0] = 2;
+    a[PGSIZE] = 3;
+    b[0] = 2;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || a[0] != 2 || a[PGSIZE] != 3 || b[0] != 1){
+    printf("%s: MAP_SHARED/MAP_PRIVATE not honoured across fork\n", s);
+    exit(1);
+  }
+
+  // an unmapped page is gone.
+  munmap(a, PGSIZE);
+  pid = fork();
+  if(pid == 0){
+    a[0] = 1;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: write to unmapped page succeeded\n", s);
+    exit(1);
+  }
+  munmap(a + PGSIZE, PGSIZE);
+  munmap(b, PGSIZE);
+}
+
 // regression test. does write() with an invalid buffer pointer cause
 // a block to be allocated for a file that is then not freed when the
 // file is deleted? if the kernel has this bug, it will panic: balloc:
@@ -2860,8 +3630,15 @@ main(int argc, char *argv[])
     {sbrkarg, "sbrkarg"},
     {sbrklast, "sbrklast"},
     {sbrk8000, "sbrk8000"},
+    {memstattest, "memstat"},
+    {lazysbrk, "lazysbrk"},
+    {superpage, "superpage"},
+    {mmaptest, "mmap"},
+    {priotest, "priority"},
+    {killpid, "killpid"},
     {validatetest, "validatetest"},
     {stacktest, "stacktest"},
+    {copyguard, "copyguard"},
     {opentest, "opentest"},
     {writetest, "writetest"},
     {writebig, "writebig"},
@@ -2880,6 +3657,12 @@ main(int argc, char *argv[])
     {dirfile, "dirfile"},
     {iref, "iref"},
     {forktest, "forktest"},
+    {manyprocs, "manyprocs"},
+    {threads, "threads"},
+    {mutexes, "mutexes"},
+    {forkthreads, "forkthreads"},
+    {forkfutex, "forkfutex"},
+    {threadexit, "threadexit"},
     {bigdir, "bigdir"}, // slow
     { 0, 0},
   };
@@ -36,3 +36,16 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("memstat");
+entry("procstat");
+entry("mmap");
+entry("munmap");
+entry("schedstat");
+entry("setpriority");
+entry("getpriority");
+entry("sched_setaffinity");
+entry("clone");
+entry("join");
+entry("futex_wait");
+entry("futex_wake");
+entry("bcachestat");